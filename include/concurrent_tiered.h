@@ -0,0 +1,294 @@
+/********************************************************************************
+* MIT License
+*
+* Copyright (c) 2017 Mikko Berggren Ettienne
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+********************************************************************************/
+#ifndef _CONCURRENT_TIERED_H_
+#define _CONCURRENT_TIERED_H_
+
+#include "templated_tiered.h"
+
+#include <mutex>
+#include <thread>
+
+namespace Seq
+{
+    // A sequence split into Shards tiered vectors, each with its own lock.
+    //
+    // A directory of shard sizes routes positional operations. It is locked
+    // only while an operation picks its shard and takes its lock, and never
+    // waits on a shard: a busy shard makes the operation drop the directory
+    // and retry, so operations on different shards do their cascades in
+    // parallel. Shards that get close to full or close to empty exchange leaf
+    // sized blocks with a neighbour, with the directory already updated and
+    // released while the blocks move.
+    template <class T, class Layer, size_t Shards>
+        class ConcurrentTiered {
+
+            public:
+                enum { block = LeafOf<Layer>::type::capacity, capacity = Shards * Layer::capacity };
+
+                size_t size() const;
+
+                void insert(size_t idx, T elem);
+                void remove(size_t idx);
+
+                T operator[](size_t idx) const;
+
+            private:
+                Tiered<T, Layer> shards[Shards];
+                size_t counts[Shards] = {};
+
+                mutable mutex directory;
+                mutable mutex locks[Shards];
+
+                size_t locate(size_t &idx, bool end) const;
+                unique_lock<mutex> lock_shard(size_t shard, unique_lock<mutex> &guard) const;
+                void move_block(size_t from, size_t to, size_t count);
+                void shift(size_t source, size_t target, size_t count, unique_lock<mutex> &guard);
+                bool make_room(size_t shard, size_t pos, unique_lock<mutex> &guard);
+                void rebalance(size_t shard, unique_lock<mutex> &guard);
+        };
+
+#define CTT template <class T, class Layer, size_t Shards>
+
+    // Find the shard holding position idx, idx becomes relative to it.
+    // With end set, a position just past a shard stays in that shard.
+    CTT
+        size_t ConcurrentTiered<T, Layer, Shards>::locate(size_t &idx, bool end) const{
+            size_t shard = 0;
+
+            while (shard < Shards - 1 && (end ? idx > counts[shard] : idx >= counts[shard])) {
+                idx -= counts[shard];
+                shard++;
+            }
+
+            return shard;
+        }
+
+    // Lock the shard if it is free. If it is busy the directory is released,
+    // so its holder is never waited on with the directory held, and the
+    // returned lock does not own the shard.
+    CTT
+        unique_lock<mutex> ConcurrentTiered<T, Layer, Shards>::lock_shard(size_t shard, unique_lock<mutex> &guard) const{
+            unique_lock<mutex> lock(locks[shard], try_to_lock);
+            if (!lock.owns_lock()) {
+                guard.unlock();
+                this_thread::yield();
+            }
+            return lock;
+        }
+
+    // Move count elements between neighbouring shards, keeping the order.
+    // Both shard locks must be held, the directory counts are updated by
+    // the caller.
+    CTT
+        void ConcurrentTiered<T, Layer, Shards>::move_block(size_t from, size_t to, size_t count){
+            auto &src = shards[from];
+            auto &dst = shards[to];
+
+            for (size_t i = 0; i < count; i++) {
+                if (from < to) {
+                    T elem = src[src.size - 1];
+                    src.remove(src.size - 1);
+                    dst.insert(0, elem);
+                } else {
+                    T elem = src[0];
+                    src.remove(0);
+                    dst.insert(dst.size, elem);
+                }
+            }
+        }
+
+    // Move count elements from source to target, every shard on the way
+    // passes count elements on so only the ends change size. Called with the
+    // directory held and releases it. If a shard involved is busy nothing
+    // moves.
+    CTT
+        void ConcurrentTiered<T, Layer, Shards>::shift(size_t source, size_t target, size_t count, unique_lock<mutex> &guard){
+            size_t first = min(source, target);
+            size_t last = max(source, target);
+            vector<unique_lock<mutex> > held;
+            for (size_t i = first; i <= last; i++) {
+                held.emplace_back(locks[i], try_to_lock);
+                if (!held.back().owns_lock()) {
+                    held.clear();
+                    guard.unlock();
+                    this_thread::yield();
+                    return;
+                }
+            }
+
+            // Routing sees the new sizes at once and waits on the shard locks
+            // until the elements are in place
+            counts[source] -= count;
+            counts[target] += count;
+            guard.unlock();
+
+            for (size_t i = target; i != source; i = target > source ? i - 1 : i + 1)
+                move_block(target > source ? i - 1 : i + 1, i, count);
+        }
+
+    // Before an insert at pos of shard, move up to a block towards the
+    // nearest shard with room once the shard is close to its capacity. Only
+    // elements on the far side of pos move, so the insert stays in the shard
+    // and a later round cannot move them back. Called with the directory
+    // held. Returns true if nothing moved and the directory is still held,
+    // otherwise the directory has been released and the caller routes again.
+    CTT
+        bool ConcurrentTiered<T, Layer, Shards>::make_room(size_t shard, size_t pos, unique_lock<mutex> &guard){
+            size_t high = Layer::capacity > 2 * block ? Layer::capacity - 2 * block : Layer::capacity - 1;
+            if (counts[shard] < high)
+                return true;
+
+            size_t right = shard + 1;
+            while (right < Shards && counts[right] == Layer::capacity)
+                right++;
+            size_t left = shard;
+            while (left > 0 && counts[left - 1] == Layer::capacity)
+                left--;
+
+            bool goRight = right < Shards && pos < counts[shard];
+            bool goLeft = left > 0 && pos > 0;
+            if (goRight && goLeft) {
+                goRight = right - shard <= shard - left + 1;
+                goLeft = !goRight;
+            }
+
+            size_t count = 0, target = shard;
+            if (goRight) {
+                target = right;
+                count = min(min((size_t)block, counts[shard] - pos), Layer::capacity - counts[target]);
+            } else if (goLeft) {
+                target = left - 1;
+                count = min(min((size_t)block, pos), Layer::capacity - counts[target]);
+            }
+            if (count == 0)
+                return true;
+
+            shift(shard, target, count, guard);
+            return false;
+        }
+
+    // Refill the shard from a crowded neighbour when it is close to empty.
+    // Called with the directory held, which is released.
+    CTT
+        void ConcurrentTiered<T, Layer, Shards>::rebalance(size_t shard, unique_lock<mutex> &guard){
+            size_t source = shard;
+
+            if (counts[shard] < block) {
+                if (shard > 0 && counts[shard - 1] >= 3 * block)
+                    source = shard - 1;
+                else if (shard < Shards - 1 && counts[shard + 1] >= 3 * block)
+                    source = shard + 1;
+            }
+
+            if (source != shard)
+                shift(source, shard, block, guard);
+        }
+
+    CTT
+        size_t ConcurrentTiered<T, Layer, Shards>::size() const{
+            lock_guard<mutex> guard(directory);
+
+            size_t res = 0;
+            for (size_t i = 0; i < Shards; i++)
+                res += counts[i];
+            return res;
+        }
+
+    CTT
+        void ConcurrentTiered<T, Layer, Shards>::insert(size_t idx, T elem){
+            for (;;) {
+                unique_lock<mutex> guard(directory);
+
+                size_t pos = idx;
+                size_t shard = locate(pos, true);
+                if (!make_room(shard, pos, guard))
+                    continue;
+
+                // A full shard that could not move anything out passes an
+                // insert at its end on to the next shard
+                if (counts[shard] == Layer::capacity && pos == counts[shard] && shard < Shards - 1) {
+                    shard++;
+                    pos = 0;
+                    if (!make_room(shard, pos, guard))
+                        continue;
+                }
+                assert((counts[shard] < Layer::capacity));
+
+                auto lock = lock_shard(shard, guard);
+                if (!lock.owns_lock())
+                    continue;
+                counts[shard]++;
+                guard.unlock();
+
+                shards[shard].insert(pos, elem);
+                return;
+            }
+        }
+
+    CTT
+        void ConcurrentTiered<T, Layer, Shards>::remove(size_t idx){
+            size_t shard;
+            for (;;) {
+                unique_lock<mutex> guard(directory);
+
+                size_t pos = idx;
+                shard = locate(pos, false);
+                assert (pos < counts[shard]);
+
+                auto lock = lock_shard(shard, guard);
+                if (!lock.owns_lock())
+                    continue;
+                counts[shard]--;
+                guard.unlock();
+
+                shards[shard].remove(pos);
+                break;
+            }
+
+            // Only an opportunity, a busy neighbour is left for later
+            unique_lock<mutex> guard(directory);
+            rebalance(shard, guard);
+        }
+
+    CTT
+        T ConcurrentTiered<T, Layer, Shards>::operator[](size_t idx) const{
+            for (;;) {
+                unique_lock<mutex> guard(directory);
+
+                size_t pos = idx;
+                size_t shard = locate(pos, false);
+                assert (pos < counts[shard]);
+
+                auto lock = lock_shard(shard, guard);
+                if (!lock.owns_lock())
+                    continue;
+                guard.unlock();
+
+                return shards[shard][pos];
+            }
+        }
+
+#undef CTT
+}
+#endif
@@ -0,0 +1,356 @@
+/********************************************************************************
+* MIT License
+*
+* Copyright (c) 2017 Mikko Berggren Ettienne
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+********************************************************************************/
+#ifndef _DYN_TIERED_H_
+#define _DYN_TIERED_H_
+
+#include "templated_tiered.h"
+
+#ifndef DYN_MAX_HEIGHT
+#define DYN_MAX_HEIGHT 8
+#endif
+
+namespace Seq
+{
+    struct DynLevel {
+        size_t *offsets;
+        size_t bits;
+        size_t shift;
+        size_t mask;
+    };
+
+    // A tiered vector whose height and widths are given at construction.
+    //
+    // widths[0] is the width of the root and the last entry the width of the
+    // leaves, all powers of two so the index math is shifts and masks. Nodes
+    // are numbered level by level as in ARRAY LEVEL mode: child k of node n
+    // is node n * width + k on the next level. The offsets of all nodes are
+    // allocated up front, leaves when they first receive an element.
+    //
+    // The operations are templates on the height so heights 2 to 4 get loops
+    // of known length, other heights use Height 0 which reads it at run time.
+    template <class T>
+        class DynTiered {
+
+            public:
+                template <size_t Height>
+                class View;
+
+                size_t size = 0;
+
+                DynTiered(const vector<size_t> &widths);
+                ~DynTiered();
+                DynTiered(const DynTiered&) = delete;
+                DynTiered& operator=(const DynTiered&) = delete;
+
+                size_t capacity() const;
+
+                void insert(size_t idx, T elem);
+                void remove(size_t idx);
+
+                const T& operator[](size_t idx) const;
+
+                template <size_t Height>
+                View<Height> view() const;
+
+            private:
+                size_t height;
+                DynLevel levels[DYN_MAX_HEIGHT + 1];
+                vector<size_t> offsets;
+                vector<T*> leaves;
+
+                template <size_t Height>
+                T& get(size_t level, size_t node, size_t idx) const;
+                template <size_t Height>
+                T& make_room(size_t idx);
+                template <size_t Height, size_t Level>
+                T pop_push(T elem, size_t level, size_t node, size_t from, size_t count, bool goRight);
+                T leaf_pop_push(T elem, size_t node, size_t from, size_t count, bool goRight);
+
+                template <size_t Height>
+                void insert_direct(size_t idx, T elem);
+                template <size_t Height>
+                void remove_direct(size_t idx);
+        };
+
+    // Read access for a tree of the given height. It copies the shifts, masks
+    // and offset pointers, which never change after construction, so a view
+    // held in a loop keeps them in registers instead of reloading them from
+    // the tree on every access. It stays valid as elements are inserted and
+    // removed, for as long as the tree lives.
+    template <class T>
+    template <size_t Height>
+        class DynTiered<T>::View {
+
+            public:
+                View(const DynTiered &tree) : leaves(tree.leaves.data()) {
+                    assert (Height == tree.height);
+                    for (size_t l = 0; l <= Height; l++)
+                        levels[l] = tree.levels[l];
+                }
+
+                const T& operator[](size_t idx) const{
+                    size_t node = 0;
+
+                    for (size_t l = 0; l + 1 < Height; l++) {
+                        idx = (idx + levels[l].offsets[node]) & levels[l].mask;
+                        node = (node << levels[l].bits) | (idx >> levels[l + 1].shift);
+                    }
+
+                    idx = (idx + levels[Height - 1].offsets[node]) & levels[Height - 1].mask;
+                    return leaves[node][idx];
+                }
+
+            private:
+                DynLevel levels[Height + 1];
+                T* const *leaves;
+        };
+
+    template <class T>
+        DynTiered<T>::DynTiered(const vector<size_t> &widths) : height(widths.size()) {
+            assert (height > 0 && height <= DYN_MAX_HEIGHT);
+
+            levels[height] = {NULL, 0, 0, 0};
+            for (size_t l = height; l-- > 0;) {
+                assert (widths[l] > 1 && (widths[l] & (widths[l] - 1)) == 0);
+
+                size_t bits = 0;
+                while (((size_t)1 << bits) < widths[l])
+                    bits++;
+
+                levels[l].bits = bits;
+                levels[l].shift = levels[l + 1].shift + bits;
+                levels[l].mask = ((size_t)1 << levels[l].shift) - 1;
+            }
+            assert (levels[0].shift < 8 * sizeof(size_t));
+
+            size_t nodes = 0;
+            for (size_t l = 0; l < height; l++)
+                nodes += (size_t)1 << (levels[0].shift - levels[l].shift);
+            offsets.assign(nodes, 0);
+
+            size_t first = 0;
+            for (size_t l = 0; l < height; l++) {
+                levels[l].offsets = &offsets[first];
+                first += (size_t)1 << (levels[0].shift - levels[l].shift);
+            }
+
+            leaves.assign((size_t)1 << (levels[0].shift - levels[height - 1].shift), NULL);
+        }
+
+    template <class T>
+        DynTiered<T>::~DynTiered() {
+            for (auto leaf : leaves)
+                delete[] leaf;
+        }
+
+    template <class T>
+        size_t DynTiered<T>::capacity() const{
+            return levels[0].mask + 1;
+        }
+
+    // Element at position idx of the given node, idx is relative to its parent
+    template <class T>
+    template <size_t Height>
+        T& DynTiered<T>::get(size_t level, size_t node, size_t idx) const{
+            const size_t last = (Height ? Height : height) - 1;
+
+            for (; level < last; level++) {
+                idx = (idx + levels[level].offsets[node]) & levels[level].mask;
+                node = (node << levels[level].bits) | (idx >> levels[level + 1].shift);
+            }
+
+            idx = (idx + levels[last].offsets[node]) & levels[last].mask;
+            return leaves[node][idx];
+        }
+
+    // Slot for position idx, allocating its leaf if needed
+    template <class T>
+    template <size_t Height>
+        T& DynTiered<T>::make_room(size_t idx){
+            const size_t last = (Height ? Height : height) - 1;
+            size_t pos = idx, node = 0;
+
+            for (size_t l = 0; l < last; l++) {
+                pos = (pos + levels[l].offsets[node]) & levels[l].mask;
+                node = (node << levels[l].bits) | (pos >> levels[l + 1].shift);
+            }
+
+            if (leaves[node] == NULL)
+                leaves[node] = new T[levels[last].mask + 1];
+
+            return get<Height>(0, 0, idx);
+        }
+
+    // With a fixed height Level is the level of the node, otherwise it is 0
+    // and level is used
+    template <class T>
+    template <size_t Height, size_t Level>
+        T DynTiered<T>::pop_push(T elem, size_t level, size_t node, size_t from, size_t count, bool goRight){
+            const size_t l = Height ? Level : level;
+            const size_t next = (Height && Level + 1 < Height) ? Level + 1 : Level;
+
+            if (count == 0)
+                return elem;
+            if (l == (Height ? Height : height) - 1)
+                return leaf_pop_push(elem, node, from, count, goRight);
+
+            // Copies, the offset stores below could otherwise alias them
+            const DynLevel cur = levels[l];
+            const DynLevel child = levels[l + 1];
+            size_t idx = (from + cur.offsets[node]) & cur.mask;
+
+            while (count > 0) {
+                size_t doCount = min(count, goRight ? (child.mask + 1 - (idx & child.mask))
+                : ((idx & child.mask) + 1));
+
+                size_t childIdx = (node << cur.bits) | (idx >> child.shift);
+
+                if (doCount == child.mask + 1) {
+                    child.offsets[childIdx] = (child.offsets[childIdx] + (goRight ? -1 : 1)) & child.mask;
+
+                    T& t = get<Height>(l + 1, childIdx, idx);
+                    T res = t;
+                    t = elem;
+                    elem = res;
+                } else {
+                    elem = pop_push<Height, next>(elem, l + 1, childIdx, idx, doCount, goRight);
+                }
+
+                idx = (idx + (goRight ? doCount : -doCount)) & cur.mask;
+                count -= doCount;
+            }
+            return elem;
+        }
+
+    template <class T>
+        T DynTiered<T>::leaf_pop_push(T elem, size_t node, size_t from, size_t count, bool goRight){
+            const DynLevel leaf = levels[height - 1];
+            size_t capacity = leaf.mask + 1;
+            size_t start = (from + leaf.offsets[node]) & leaf.mask;
+            auto elems = leaves[node];
+            T res;
+
+            if (goRight) {
+                res = elems[(start + count - 1) & leaf.mask];
+                size_t beforeWrap = min(capacity - start - 1, count - 1);
+
+                // Move last part
+                if (beforeWrap < count - 1) {
+                    memmove(&elems[1], &elems[0], (count - beforeWrap - 2) * sizeof(T));
+                    elems[0] = elems[capacity - 1];
+                }
+
+                // Move first part
+                memmove(&elems[start + 1], &elems[start], beforeWrap * sizeof(T));
+            } else {
+                res = elems[(start - count + 1) & leaf.mask];
+                size_t beforeWrap = min(start, count - 1);
+
+                if (beforeWrap < count - 1) {
+                    size_t afterWrap = count - beforeWrap - 2;
+                    memmove(&elems[capacity - afterWrap - 1], &elems[capacity - afterWrap], afterWrap * sizeof(T));
+                    elems[capacity - 1] = elems[0];
+                }
+
+                memmove(&elems[start - beforeWrap], &elems[start - beforeWrap + 1], beforeWrap * sizeof(T));
+            }
+
+            elems[start] = elem;
+            return res;
+        }
+
+    template <class T>
+    template <size_t Height>
+        void DynTiered<T>::insert_direct(size_t idx, T elem){
+            if (idx >= size/2) {
+                elem = pop_push<Height, 0>(elem, 0, 0, idx, size - idx, true);
+                make_room<Height>(size) = elem;
+            } else {
+                elem = pop_push<Height, 0>(elem, 0, 0, (idx - 1) & levels[0].mask, idx, false);
+                levels[0].offsets[0] = (levels[0].offsets[0] - 1) & levels[0].mask;
+                make_room<Height>(0) = elem;
+            }
+
+            size++;
+        }
+
+    template <class T>
+    template <size_t Height>
+        void DynTiered<T>::remove_direct(size_t idx){
+            T garbage = {};
+
+            if (idx >= size/2) {
+                size--;
+                pop_push<Height, 0>(garbage, 0, 0, size, size - idx + 1, false);
+            } else {
+                pop_push<Height, 0>(garbage, 0, 0, 0, idx + 1, true);
+                size--;
+                levels[0].offsets[0] = (levels[0].offsets[0] + 1) & levels[0].mask;
+            }
+        }
+
+    template <class T>
+        const T& DynTiered<T>::operator[](size_t idx) const{
+            assert (idx < size);
+
+            switch (height) {
+                case 2: return get<2>(0, 0, idx);
+                case 3: return get<3>(0, 0, idx);
+                case 4: return get<4>(0, 0, idx);
+                default: return get<0>(0, 0, idx);
+            }
+        }
+
+    template <class T>
+    template <size_t Height>
+        typename DynTiered<T>::template View<Height> DynTiered<T>::view() const{
+            return View<Height>(*this);
+        }
+
+    template <class T>
+        void DynTiered<T>::insert(size_t idx, T elem){
+            assert (size < capacity());
+            assert (idx <= size);
+
+            switch (height) {
+                case 2: insert_direct<2>(idx, elem); break;
+                case 3: insert_direct<3>(idx, elem); break;
+                case 4: insert_direct<4>(idx, elem); break;
+                default: insert_direct<0>(idx, elem); break;
+            }
+        }
+
+    template <class T>
+        void DynTiered<T>::remove(size_t idx){
+            assert (idx < size);
+
+            switch (height) {
+                case 2: remove_direct<2>(idx); break;
+                case 3: remove_direct<3>(idx); break;
+                case 4: remove_direct<4>(idx); break;
+                default: remove_direct<0>(idx); break;
+            }
+        }
+}
+#endif
@@ -34,6 +34,20 @@
 #include <stack>
 #include <queue>
 #include <bitset>
+#include <utility>
+#include <iterator>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdint>
+#include <new>
+#include <atomic>
+
+#ifdef PARALLEL
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#endif
 
 #ifdef PPACK
 #define INODE FakeNode<Elem>
@@ -44,6 +58,80 @@
 
 #define WRAP(a,b) (((a) + (b)) % (b))
 
+#ifndef BUFFER_SIZE
+#define BUFFER_SIZE 64
+#endif
+
+#ifndef BUFFER_MERGE
+#define BUFFER_MERGE 8
+#endif
+
+#ifdef SLACK
+#if defined(ARRAY) || defined(PPACK)
+#error "SLACK is only supported with the pointer based layout"
+#endif
+#ifndef SLACK_RATIO
+#define SLACK_RATIO 8
+#endif
+// 1 / SLACK_RATIO of the leaf slots are kept free
+#define LEAF_CAPACITY(w) ((w) - (w) / SLACK_RATIO)
+#else
+#define LEAF_CAPACITY(w) (w)
+#endif
+
+#ifndef CACHE_LINE
+#define CACHE_LINE 64
+#endif
+
+#ifdef INDIRECT
+#ifdef BUFFER
+#error "INDIRECT does not combine with BUFFER"
+#endif
+// The arena grows in blocks of 2^ARENA_BITS elements
+#ifndef ARENA_BITS
+#define ARENA_BITS 12
+#endif
+#endif
+
+#ifdef POOL
+#if !defined(ARRAY) || !defined(PACK) || defined(PFREE)
+#error "POOL requires ARRAY and PACK and does not combine with PFREE"
+#endif
+#endif
+
+#ifdef PACK
+// A leaf's offset word holds its rotation above PACK_SHIFT and the leaf below:
+// a pointer, or with POOL its number in the leaf pool
+#ifdef POOL
+#define PACK_SHIFT 32
+#else
+#define PACK_SHIFT 48
+#endif
+#define PACK_MASK (((size_t)1 << PACK_SHIFT) - 1)
+#endif
+
+#ifdef PARALLEL
+#ifdef COMPACT
+#error "PARALLEL is not supported with COMPACT, neighbouring offsets share a word"
+#endif
+// Minimum number of full children in a cascade before it is split over threads
+#ifndef PARALLEL_MIN
+#define PARALLEL_MIN 256
+#endif
+// Number of children handled by one task
+#ifndef PARALLEL_CHUNK
+#define PARALLEL_CHUNK 64
+#endif
+#endif
+
+// Node depth and id are only needed by print()
+#if !defined(SLIM) || defined(DEBUG)
+#define NODE_IDS
+#define NODE_ID(node, n) ((node)->id)
+#else
+#define NODE_ID(node, n) (n)
+#endif
+
 using namespace std;
 
 namespace Seq
@@ -55,9 +143,12 @@ namespace Seq
 #else
         void** ptrs;
 #endif
-#ifdef PFREE
+#if defined(PFREE) || defined(POOL)
         void* elems;
 #endif
+#ifdef POOL
+        size_t* leaves;
+#endif
 #endif
     };
 
@@ -66,6 +157,34 @@ namespace Seq
         size_t child;
     };
 
+    // A pending insert of elem, or remove when elem is NULL, at a distance
+    // from the start of a cascade
+    template <class T>
+    struct Edit {
+        size_t at;
+        const T *elem;
+    };
+
+#ifdef SLIM
+    typedef uint32_t NodeWord;
+#else
+    typedef size_t NodeWord;
+#endif
+
+    // Base of the heap allocated nodes, in SLIM mode they start on a cache line
+    struct NodeAlloc {
+#ifdef SLIM
+        static void* operator new(size_t bytes) {
+            void* res;
+            if (posix_memalign(&res, CACHE_LINE, bytes) != 0) throw bad_alloc();
+            return res;
+        }
+        static void operator delete(void* ptr) {
+            free(ptr);
+        }
+#endif
+    };
+
     template <size_t Num>
     struct Math {
        enum { log = Math<(Num + 1) / 2>::log + 1, logdown = Math<Num / 2>::logdown + 1 };
@@ -86,6 +205,19 @@ namespace Seq
        enum { value = 1 };
     };
 
+#ifdef SLACK
+    // Most elements a run of leaves with room slots, slack of them beyond its
+    // capacity, may hold in SLACK mode. It falls from all of them for a single
+    // leaf to the capacity for all tree_leaves, stepping with the binary
+    // logarithm of the run length
+    inline size_t slack_limit(size_t room, size_t slack, size_t leaves, size_t tree_leaves) {
+        size_t bits = 0, tree_bits = 0;
+        while (((size_t)1 << bits) < leaves) bits++;
+        while (((size_t)1 << tree_bits) < tree_leaves) tree_bits++;
+        return room - slack * bits / tree_bits;
+    }
+#endif
+
     struct LayerEnd { typedef LayerEnd child; enum { width = 0, capacity = 0, height = 0, nodes = 0, depth = 0 }; };
 
     template <size_t Width, typename NextType = LayerEnd>
@@ -96,7 +228,7 @@ namespace Seq
 
     template <size_t Width>
     struct Layer<Width, LayerEnd> { 
-        enum { width = Width, capacity = Width, height = 0, nodes = 1 };
+        enum { width = Width, capacity = LEAF_CAPACITY(Width), height = 0, nodes = 1 };
         typedef LayerEnd child;
     };
 
@@ -119,6 +251,17 @@ namespace Seq
         };
     };
 
+    // The leaf layer below a layer
+    template <class L, size_t Height = L::height>
+    struct LeafOf {
+        typedef typename LeafOf<typename L::child>::type type;
+    };
+
+    template <class L>
+    struct LeafOf<L, 0> {
+        typedef L type;
+    };
+
     struct FakeParent {
         typedef FakeParent parent;
         enum { top_nodes = 0, width = 1, top_width = 0 };
@@ -133,38 +276,171 @@ namespace Seq
     };
 
     template <class T, size_t width>
-        class Node {
+        class Node : public NodeAlloc {
             public:
                 Node(size_t depth);
+#ifdef NODE_IDS
                 size_t depth;
-                size_t size = 0;
+#endif
+                NodeWord size = 0;
+#ifdef NODE_IDS
                 size_t id;
+#endif
 #ifdef PPACK
 #else
-                size_t offset = 0;
+                NodeWord offset = 0;
 #endif
                 T elems[width];
         };
 
     template <class T>
-        class FakeNode {
+        class FakeNode : public NodeAlloc {
             public:
+#ifdef NODE_IDS
                 size_t depth;
-                size_t size = 0;
+#endif
+                NodeWord size = 0;
+#ifdef NODE_IDS
                 size_t id;
+#endif
 #ifdef PPACK
 #else
-                size_t offset = 0;
+                NodeWord offset = 0;
 #endif
                 T elems[];
         };
 
+#ifdef SLACK
+    // Child of a SLACK mode node, end is the number of elements in this and
+    // all preceding children
+    struct SlackElem {
+        size_t end;
+        void* child;
+    };
+
+    // Internal node in SLACK mode. Children are not rotated and may hold any
+    // number of elements, count is the number of elements in the subtree.
+    // The size allocated children are always the first ones.
+    template <size_t width>
+        class SlackNode : public NodeAlloc {
+            public:
+                SlackNode(size_t depth);
+#ifdef NODE_IDS
+                size_t depth;
+#endif
+                NodeWord size = 0;
+#ifdef NODE_IDS
+                size_t id;
+#endif
+                NodeWord count = 0;
+                SlackElem elems[width];
+        };
+#endif
+
+#ifdef PARALLEL
+    // Fixed set of worker threads running one batch of tasks at a time.
+    // The calling thread takes part, and a batch started from inside a task
+    // runs inline.
+    class ThreadPool {
+        public:
+            ThreadPool(size_t threads);
+            ~ThreadPool();
+            void run(size_t count, const function<void(size_t)> &task);
+            size_t threads() const { return workers.size(); }
+
+        private:
+            void work();
+
+            vector<thread> workers;
+            mutex batch;
+            mutex lock;
+            condition_variable start;
+            condition_variable done;
+            const function<void(size_t)> *task = NULL;
+            atomic<size_t> next;
+            atomic<size_t> total;
+            atomic<size_t> pending;
+            size_t active = 0;
+            size_t generation = 0;
+            bool stop = false;
+    };
+
+    inline ThreadPool& thread_pool();
+#endif
+
+#ifdef INDIRECT
+    // Storage for the elements in INDIRECT mode. Elements are addressed by a
+    // 32 bit handle and never move, freed handles are reused first.
+    template <class T>
+    class Arena {
+        public:
+            Arena() {}
+            ~Arena();
+            Arena(const Arena&) = delete;
+            Arena& operator=(const Arena&) = delete;
+
+            uint32_t alloc(const T &elem);
+            void release(uint32_t handle);
+
+            T& operator[](uint32_t handle) { return blocks[handle >> ARENA_BITS][handle & ((1 << ARENA_BITS) - 1)]; }
+            const T& operator[](uint32_t handle) const { return blocks[handle >> ARENA_BITS][handle & ((1 << ARENA_BITS) - 1)]; }
+
+        private:
+            vector<T*> blocks;
+            vector<uint32_t> free;
+            uint32_t used = 0;
+    };
+#endif
+
     template <class T, class Layer>
         class Tiered {
 
             public:
+#ifdef SLIM
+                static_assert((unsigned long long)Layer::capacity <= UINT32_MAX, "SLIM node headers need a capacity that fits in 32 bits");
+#endif
+#ifdef POOL
+                static_assert((unsigned long long)Layer::nodes < UINT32_MAX, "POOL leaf numbers are 32 bits");
+#endif
+#ifdef INDIRECT
+                static_assert((unsigned long long)Layer::capacity <= UINT32_MAX, "INDIRECT handles are 32 bits");
+
+                // The tree holds handles into the arena instead of elements
+                typedef uint32_t Stored;
+                Arena<T> arena;
+#else
+                typedef T Stored;
+#endif
+                Stored store(const T &elem);
+                const T& load(const Stored &elem) const;
+
                 Info info;
                 size_t size = 0;
+#ifdef BUFFER
+                // Pending edits not yet applied to the tree: inserted elements
+                // keyed by their logical position and removed tree positions,
+                // both kept sorted
+                vector<pair<size_t, T> > pending_ins;
+                vector<size_t> pending_del;
+
+                size_t buffer_find(size_t idx) const;
+                size_t buffer_translate(size_t idx) const;
+#ifndef SLACK
+                // Edits and carried elements of a merged flush, kept between
+                // flushes
+                vector<Edit<Stored> > edits;
+                vector<Stored> carry;
+
+                bool buffer_clustered() const;
+                void buffer_merge();
+                void buffer_cascade(size_t carried, size_t from, size_t count, bool goRight);
+#endif
+#endif
+#if defined(BUFFER) || defined(SLACK)
+                // Leaf scratch space of a merged flush, or the elements of a
+                // SLACK subtree being spread, kept between calls
+                vector<Stored> scratch;
+#endif
 #ifdef ARRAY
                 const static size_t root = 0;
 #else
@@ -191,28 +467,96 @@ namespace Seq
                 void print();
                 void fill(T *res);
                 void remove(size_t idx);
+                void remove_direct(size_t idx);
 
                 T sum(size_t from, size_t count);
                 size_t successor(T elem);
 
+                // Linear search by value, positions are size when nothing matches
+                size_t find(T elem, size_t from = 0);
+                template <class Pred>
+                size_t find_if(Pred pred, size_t from = 0);
+                bool contains(T elem);
+                size_t count(T elem);
+                template <class Pred>
+                size_t count_if(Pred pred);
+#ifdef PARALLEL
+                size_t parallel_tasks(size_t from) const;
+                size_t parallel_task_start(size_t from, size_t task) const;
+#endif
+
                 void insert(size_t idx, T elem);
+                void insert_direct(size_t idx, T elem);
+                void resize_direct(size_t n);
                 void insert_sorted(T elem);
+                void flush();
+                template <class Itr>
+                void insert_sorted_batch(Itr first, Itr last);
+
+                // Sorted mode: the sequence is assumed to be ordered by operator<
+                size_t lower_bound(T elem) const;
+                size_t upper_bound(T elem) const;
+                pair<size_t, size_t> equal_range(T elem) const;
+                size_t erase_value(T elem);
+                size_t count_range(T lo, T hi) const;
+                bool contains_sorted(T elem) const;
+                size_t rank(T elem) const;
+                const T& nth(size_t idx) const;
 
                 const T& operator[](size_t idx) const;
                 void randomize();
         };
 
 };
-#endif
 
 #define TT template <class T, class Layer>
 
+#ifndef SCAN_BLOCK
+#define SCAN_BLOCK 32
+#endif
+
 
-size_t ID = 0;
+#ifdef NODE_IDS
+// Atomic as the shards of a ConcurrentTiered allocate nodes in parallel
+std::atomic<size_t> ID(0);
+#endif
 
 
 namespace Seq
 {
+    template <class T>
+    struct Equal {
+        const T &value;
+        Equal(const T &value) : value(value) {}
+        bool operator()(const T &elem) const { return elem == value; }
+    };
+
+    // Index of the first of count elements matching pred, or count. Every
+    // block of SCAN_BLOCK elements is tested without an early exit so the
+    // compiler can vectorize the compares
+    template <class T, class Pred>
+    inline size_t scan_find(const T *elems, size_t count, const Pred &pred) {
+        size_t i = 0;
+        for (; i + SCAN_BLOCK <= count; i += SCAN_BLOCK) {
+            unsigned hit = 0;
+            for (size_t j = 0; j < SCAN_BLOCK; j++)
+                hit |= pred(elems[i + j]);
+            if (hit) break;
+        }
+        for (; i < count; i++)
+            if (pred(elems[i])) return i;
+        return count;
+    }
+
+    template <class T, class Pred>
+    inline size_t scan_count(const T *elems, size_t count, const Pred &pred) {
+        size_t res = 0;
+        for (size_t i = 0; i < count; i++)
+            res += pred(elems[i]);
+        return res;
+    }
+
+#ifndef SLACK
     TT
     struct helper {
 
@@ -375,6 +719,11 @@ namespace Seq
         static T pop_push(T elem, size_t addr, size_t from, size_t count, bool goRight, Info info){
             size_t idx = (from + helper<T, Layer>::get_offset(addr, info)) % Layer::capacity;
 
+#ifdef PARALLEL
+            if (count / Layer::child::capacity >= PARALLEL_MIN && thread_pool().threads() > 0)
+                return pop_push_parallel(elem, addr, idx, count, goRight, info);
+#endif
+
             while (count > 0) {
                 size_t doCount = min(count, goRight ? (Layer::child::capacity - (idx % Layer::child::capacity))
                 : (idx % Layer::child::capacity + 1));
@@ -395,6 +744,166 @@ namespace Seq
             return elem;
         }
 
+#ifdef PARALLEL
+        struct Step {
+            size_t child;
+            size_t idx;
+            size_t count;
+            T elem;
+        };
+
+        static void apply(Step &step, bool goRight, Info info) {
+            if (step.count == Layer::child::capacity) {
+                helper<T, typename Layer::child>::set_offset(step.child, WRAP((helper<T, typename Layer::child>::get_offset(step.child, info)) + (goRight ? -1 : 1), Layer::child::capacity), info);
+                helper<T, typename Layer::child>::replace(step.elem, step.child, step.idx, info);
+            } else {
+                helper<T, typename Layer::child>::pop_push(step.elem, step.child, step.idx, step.count, goRight, info);
+            }
+        }
+
+        // Same as the loop in pop_push, but the element carried into each child
+        // is read up front so the children can be updated independently
+        static T pop_push_parallel(T elem, size_t addr, size_t idx, size_t count, bool goRight, Info info) {
+            vector<Step> steps;
+
+            while (count > 0) {
+                size_t doCount = min(count, goRight ? (Layer::child::capacity - (idx % Layer::child::capacity))
+                : (idx % Layer::child::capacity + 1));
+
+                auto child = get_child(addr, idx / Layer::child::capacity);
+                size_t last = WRAP(idx + (goRight ? doCount - 1 : -(doCount - 1)), Layer::capacity);
+
+                steps.push_back({child, idx, doCount, elem});
+                elem = helper<T, typename Layer::child>::get(child, last, info);
+
+                idx = WRAP(idx + (goRight ? doCount : -doCount), Layer::capacity);
+                count -= doCount;
+            }
+
+            // A range wrapping around the node can start and end in the same
+            // child, that child is updated last
+            bool shared = steps.size() > 1 && steps.front().child == steps.back().child;
+            size_t parallel = steps.size() - shared;
+
+            thread_pool().run((parallel + PARALLEL_CHUNK - 1) / PARALLEL_CHUNK, [&](size_t chunk) {
+                for (size_t i = chunk * PARALLEL_CHUNK; i < min(parallel, (chunk + 1) * PARALLEL_CHUNK); i++)
+                    apply(steps[i], goRight, info);
+            });
+
+            if (shared)
+                apply(steps.back(), goRight, info);
+
+            return elem;
+        }
+#endif
+
+        // Like pop_push with k carried elements: they enter the range at from
+        // in order, the range moves k places and the k elements pushed out of
+        // it are left in carry. carry is a ring starting at j, j is moved past
+        // the elements used. A full child is rotated by k and only the k
+        // elements that wrapped around are exchanged
+        static void pop_push_many(T* carry, size_t k, size_t &j, size_t addr, size_t from, size_t count, bool goRight, Info info) {
+            size_t idx = (from + get_offset(addr, info)) % Layer::capacity;
+
+            while (count > 0) {
+                size_t doCount = min(count, goRight ? (Layer::child::capacity - (idx % Layer::child::capacity))
+                : (idx % Layer::child::capacity + 1));
+
+                pass_child(carry, k, j, get_child(addr, idx / Layer::child::capacity), idx, doCount, goRight, info);
+
+                idx = WRAP(idx + (goRight ? doCount : -doCount), Layer::capacity);
+                count -= doCount;
+            }
+        }
+
+        // Pass k carried elements through count positions of child from idx
+        static void pass_child(T* carry, size_t k, size_t &j, size_t child, size_t idx, size_t count, bool goRight, Info info) {
+            // A single element takes the path of pop_push
+            if (k == 1) {
+                if (count == Layer::child::capacity) {
+                    helper<T, typename Layer::child>::set_offset(child, WRAP((helper<T, typename Layer::child>::get_offset(child, info)) + (goRight ? -1 : 1), Layer::child::capacity), info);
+                    carry[0] = helper<T, typename Layer::child>::replace(carry[0], child, idx, info);
+                } else {
+                    carry[0] = helper<T, typename Layer::child>::pop_push(carry[0], child, idx, count, goRight, info);
+                }
+                return;
+            }
+
+            if (count == Layer::child::capacity && k < count) {
+                helper<T, typename Layer::child>::set_offset(child, (helper<T, typename Layer::child>::get_offset(child, info) + (goRight ? count - k : k)) % Layer::child::capacity, info);
+                count = k;
+            }
+            helper<T, typename Layer::child>::pop_push_many(carry, k, j, child, idx, count, goRight, info);
+        }
+
+        // pass_child with carry starting in order and left in order
+        static void pass_child(T* carry, size_t k, size_t child, size_t idx, size_t count, bool goRight, Info info) {
+            size_t j = 0;
+            pass_child(carry, k, j, child, idx, count, goRight, info);
+            rotate(carry, carry + j, carry + k);
+        }
+
+        // pop_push_many applying the n edits on the way, at is the distance of
+        // from from the start of the cascade. An insert enters the carried
+        // elements before the element at its distance, a remove drops that
+        // element, k is updated to the number of elements carried out.
+        // Children up to the next edit are passed as by pop_push_many, a full
+        // child with edits is first rotated by the elements passing over it
+        // and the edits then only cascade within the child
+        static void pop_push_edits(T* carry, size_t &k, size_t addr, size_t from, size_t count, bool goRight, const Edit<T>* edits, size_t n, size_t at, vector<T> &scratch, Info info) {
+            while (count > 0) {
+                size_t idx = (from + get_offset(addr, info)) % Layer::capacity;
+                size_t doCount = min(count, goRight ? (Layer::child::capacity - (idx % Layer::child::capacity))
+                : (idx % Layer::child::capacity + 1));
+
+                if (n == 0 || edits[0].at >= at + doCount) {
+                    size_t pass = n == 0 ? count : doCount + (edits[0].at - at - doCount) / Layer::child::capacity * Layer::child::capacity;
+
+                    if (k == 1) {
+                        carry[0] = pop_push(carry[0], addr, from, pass, goRight, info);
+                    } else if (k > 0) {
+                        size_t j = 0;
+                        pop_push_many(carry, k, j, addr, from, pass, goRight, info);
+                        rotate(carry, carry + j, carry + k);
+                    }
+
+                    from = WRAP(from + (goRight ? pass : -pass), Layer::capacity);
+                    count -= pass;
+                    at += pass;
+                    continue;
+                }
+
+                auto child = get_child(addr, idx / Layer::child::capacity);
+
+                size_t m = 0, ins = 0;
+                for (; m < n && edits[m].at < at + doCount; m++)
+                    ins += edits[m].elem != NULL;
+
+                size_t out = k + ins - (m - ins);
+                size_t r = min(k, out);
+
+                if (doCount == Layer::child::capacity && r > 0 && r < doCount && edits[m - 1].at < at + doCount - r) {
+                    pass_child(carry, r, child, idx, doCount, goRight, info);
+
+                    // The elements rotated out leave the child after the
+                    // ones the edits push out
+                    size_t inner = k - r;
+                    helper<T, typename Layer::child>::pop_push_edits(carry + r, inner, child, goRight ? idx + r : idx - r, doCount - r, goRight, edits, m, at, scratch, info);
+                    rotate(carry, carry + r, carry + out);
+                } else {
+                    helper<T, typename Layer::child>::pop_push_edits(carry, k, child, idx, doCount, goRight, edits, m, at, scratch, info);
+                }
+
+                k = out;
+                edits += m;
+                n -= m;
+
+                from = WRAP(from + (goRight ? doCount : -doCount), Layer::capacity);
+                count -= doCount;
+                at += doCount;
+            }
+        }
+
         inline static T sum(size_t addr, size_t from, size_t count, Info info) {
             T s = T();
             size_t idx = (from + get_offset(addr, info)) % Layer::capacity;
@@ -410,6 +919,40 @@ namespace Seq
             return s;
         }
 
+        template <class Pred>
+        static size_t find(size_t addr, size_t from, size_t count, const Pred &pred, Info info) {
+            size_t idx = (from + get_offset(addr, info)) % Layer::capacity;
+            size_t done = 0;
+
+            while (done < count) {
+                size_t doCount = min(count - done, Layer::child::capacity - (idx % Layer::child::capacity));
+                auto child = get_child(addr, idx / Layer::child::capacity);
+                size_t res = helper<T, typename Layer::child>::find(child, idx, doCount, pred, info);
+                if (res < doCount)
+                    return done + res;
+                idx = (idx + doCount) % Layer::capacity;
+                done += doCount;
+            }
+
+            return count;
+        }
+
+        template <class Pred>
+        static size_t count_if(size_t addr, size_t from, size_t count, const Pred &pred, Info info) {
+            size_t res = 0;
+            size_t idx = (from + get_offset(addr, info)) % Layer::capacity;
+
+            while (count > 0) {
+                size_t doCount = min(count, Layer::child::capacity - (idx % Layer::child::capacity));
+                auto child = get_child(addr, idx / Layer::child::capacity);
+                res += helper<T, typename Layer::child>::count_if(child, idx, doCount, pred, info);
+                idx = (idx + doCount) % Layer::capacity;
+                count -= doCount;
+            }
+
+            return res;
+        }
+
         static T replace(T elem, size_t addr, size_t idx, Info info) {
             T& t = get(addr, idx, info);
             T res = t;
@@ -425,7 +968,7 @@ namespace Seq
 #else
             auto node = (INODE*) addr;
 #endif
-            cout << n << " [label=\"" << node->id << " (" << node->size << "/" << get_offset(addr, info) << ")\"]" << endl;
+            cout << n << " [label=\"" << NODE_ID(node, n) << " (" << node->size << "/" << get_offset(addr, info) << ")\"]" << endl;
 
             for (int i = 0; i < Layer::width; i++) {
                 auto elem = node->elems[i];
@@ -476,6 +1019,18 @@ namespace Seq
 #endif
             return info.offsets[addr];
         }
+
+#ifdef POOL
+        // Leaves are numbered from 1 in the order they are created, 0 is none
+        // and the pool's first leaf sized block is unused
+        static T* leaf_elems(size_t off, Info info) {
+            return &((T*)info.elems)[(off & PACK_MASK) * L::width];
+        }
+#else
+        static T* leaf_elems(size_t off, Info info) {
+            return (T*)(off & PACK_MASK);
+        }
+#endif
 #endif
 
 #ifdef ARRAY
@@ -492,7 +1047,7 @@ namespace Seq
 #endif
 #ifdef PACK
             size_t off = info.offsets[addr];
-            return off >> 48;
+            return off >> PACK_SHIFT;
 #else
 
            return info.offsets[addr];
@@ -515,9 +1070,7 @@ namespace Seq
 
 #ifdef PACK
             size_t off = info.offsets[addr];
-            size_t ptr = ((off << 16) >> 16);
-            size_t n_offset = (offset << 48) | ptr;
-            info.offsets[addr] = n_offset;
+            info.offsets[addr] = (offset << PACK_SHIFT) | (off & PACK_MASK);
 #else
             info.offsets[addr] = offset;
 #endif
@@ -526,10 +1079,7 @@ namespace Seq
 #ifdef PFREE
             return ((T*)info.elems)[addr * L::width + idx];
 #elif defined(PACK)
-            size_t off = get_fake_offset(addr, info);
-            size_t ptr = ((off << 16) >> 16);
-            //cerr << ((T*)ptr)[idx] << " GET " <<endl;
-            return ((T*)ptr)[idx];
+            return leaf_elems(get_fake_offset(addr, info), info)[idx];
 #else
 
             return ((T*)info.ptrs[addr])[idx];
@@ -540,11 +1090,18 @@ namespace Seq
             return addr;
 #elif defined(PACK)
             size_t offset = get_fake_offset(addr, info);
-            if(offset << 16 == 0) {
-                size_t arr_addr = (size_t) new T[L::width];
-                assert((arr_addr >> 48) == 0);
+            if((offset & PACK_MASK) == 0) {
+#ifdef POOL
+                size_t leaf = ++*info.leaves;
+                T* elems = &((T*)info.elems)[leaf * L::width];
+                for (size_t i = 0; i < L::width; i++)
+                    new (&elems[i]) T();
+#else
+                size_t leaf = (size_t) new T[L::width];
+                assert((leaf >> PACK_SHIFT) == 0);
+#endif
 
-                size_t n_offset = (offset << 48) | arr_addr;
+                size_t n_offset = (offset & ~PACK_MASK) | leaf;
 
 #ifdef LINE
                 addr = addr + L::parent::parent::top_nodes;
@@ -598,9 +1155,7 @@ namespace Seq
 #ifdef PFREE
             auto elems = &((T*)info.elems)[addr*L::width];
 #elif defined(PACK)
-            size_t off = get_fake_offset(addr, info);
-            size_t ptr = ((off << 16) >> 16);
-            auto elems =  (T*)ptr;
+            auto elems = leaf_elems(get_fake_offset(addr, info), info);
 #else
             auto elems = (T*)info.ptrs[addr];
 #endif
@@ -644,32 +1199,122 @@ namespace Seq
 
             return res;
         }
+
+        static void pop_push_many(T* carry, size_t k, size_t &j, size_t addr, size_t from, size_t count, bool goRight, Info info) {
+            auto elems = get_elems(addr, info);
+            size_t pos = (from + get_offset(addr, info)) % L::capacity;
+
+            // carry[j] holds the element due at the current position, the one
+            // taken from there is due k positions later. Swapped in runs that
+            // wrap neither the leaf nor the carry
+            while (count > 0) {
+                size_t len = min(min(count, k - j), goRight ? L::capacity - pos : pos + 1);
+
+                if (goRight) {
+                    swap_ranges(elems + pos, elems + pos + len, carry + j);
+                    pos = pos + len == L::capacity ? 0 : pos + len;
+                } else {
+                    for (size_t i = 0; i < len; i++)
+                        swap(elems[pos - i], carry[j + i]);
+                    pos = pos < len ? L::capacity - 1 : pos - len;
+                }
+
+                j = j + len == k ? 0 : j + len;
+                count -= len;
+            }
+        }
+
+        // Copy count elements of the leaf in cascade order from pos to out,
+        // or from in back to them
+        static void gather(const T* elems, size_t pos, size_t count, bool goRight, T* out) {
+            size_t first = min(count, goRight ? L::capacity - pos : pos + 1);
+            if (goRight) {
+                copy(elems + pos, elems + pos + first, out);
+                copy(elems, elems + count - first, out + first);
+            } else {
+                reverse_copy(elems + pos + 1 - first, elems + pos + 1, out);
+                reverse_copy(elems + L::capacity - (count - first), elems + L::capacity, out + first);
+            }
+        }
+
+        static void scatter(T* elems, size_t pos, size_t count, bool goRight, const T* in) {
+            size_t first = min(count, goRight ? L::capacity - pos : pos + 1);
+            if (goRight) {
+                copy(in, in + first, elems + pos);
+                copy(in + first, in + count, elems);
+            } else {
+                reverse_copy(in, in + first, elems + pos + 1 - first);
+                reverse_copy(in + first, in + count, elems + L::capacity - (count - first));
+            }
+        }
+
+        static void pop_push_edits(T* carry, size_t &k, size_t addr, size_t from, size_t count, bool goRight, const Edit<T>* edits, size_t n, size_t at, vector<T> &scratch, Info info) {
+            auto elems = get_elems(addr, info);
+
+            // The range up to the first edit only passes the carried elements on
+            size_t skip = edits[0].at - at;
+            if (skip > 0 && k == 1) {
+                carry[0] = pop_push(carry[0], addr, from, skip, goRight, info);
+            } else if (skip > 0 && k > 1) {
+                size_t j = 0;
+                pop_push_many(carry, k, j, addr, from, skip, goRight, info);
+                rotate(carry, carry + j, carry + k);
+            }
+            from = WRAP(from + (goRight ? skip : -skip), L::capacity);
+            count -= skip;
+            at += skip;
+            size_t pos = (from + get_offset(addr, info)) % L::capacity;
+
+            // The carried elements followed by the range with the edits applied,
+            // the first count go back into the range
+            if (scratch.size() < k + n + 2 * count)
+                scratch.resize(k + n + 2 * count);
+            T *range = scratch.data() + k + n + count;
+            T *out = copy(carry, carry + k, scratch.data());
+            gather(elems, pos, count, goRight, range);
+
+            size_t i = 0;
+            for (size_t e = 0; e < n; e++) {
+                out = copy(range + i, range + (edits[e].at - at), out);
+                i = edits[e].at - at;
+                if (edits[e].elem != NULL)
+                    *out++ = *edits[e].elem;
+                else
+                    i++;
+            }
+            out = copy(range + i, range + count, out);
+
+            scatter(elems, pos, count, goRight, scratch.data());
+            k = out - scratch.data() - count;
+            copy(scratch.data() + count, out, carry);
+        }
+
         static T& get(size_t addr, size_t idx, Info info) {
             idx = (idx + helper<T, L>::get_offset(addr, info)) % L::capacity;
             return get_elem(addr, idx, info);
         }
 
-        inline static T sum(size_t addr, size_t from, size_t count, Info info) {
-            T s = T();
-
+        static T* get_elems(size_t addr, Info info) {
 #ifdef ARRAY
 #ifdef PFREE
-            auto elems = &((T*)info.elems)[addr*L::width];
+            return &((T*)info.elems)[addr*L::width];
 #elif defined(PACK)
-            size_t off = get_fake_offset(addr, info);
-            size_t ptr = ((off << 16) >> 16);
-            auto elems =  (T*)ptr;
+            return leaf_elems(get_fake_offset(addr, info), info);
 #else
-            auto elems = (T*)info.ptrs[addr];
+            return (T*)info.ptrs[addr];
 #endif
 #else
 #ifdef PPACK
-            auto elems = ((LNODE*) ((Elem*)addr)->child)->elems;
+            return ((LNODE*) ((Elem*)addr)->child)->elems;
 #else
-            auto elems = ((LNODE*)addr)->elems;
+            return ((LNODE*)addr)->elems;
 #endif
 #endif
- 
+        }
+
+        inline static T sum(size_t addr, size_t from, size_t count, Info info) {
+            T s = T();
+            auto elems = get_elems(addr, info);
 
             from = (from + get_offset(addr, info)) % L::capacity;
 
@@ -690,6 +1335,28 @@ namespace Seq
             return s;
         }
 
+        template <class Pred>
+        static size_t find(size_t addr, size_t from, size_t count, const Pred &pred, Info info) {
+            auto elems = get_elems(addr, info);
+            from = (from + get_offset(addr, info)) % L::capacity;
+
+            size_t firstCount = min(count, L::capacity - from);
+            size_t res = scan_find(elems + from, firstCount, pred);
+            if (res < firstCount || firstCount == count)
+                return res;
+
+            return firstCount + scan_find(elems, count - firstCount, pred);
+        }
+
+        template <class Pred>
+        static size_t count_if(size_t addr, size_t from, size_t count, const Pred &pred, Info info) {
+            auto elems = get_elems(addr, info);
+            from = (from + get_offset(addr, info)) % L::capacity;
+
+            size_t firstCount = min(count, L::capacity - from);
+            return scan_count(elems + from, firstCount, pred) + scan_count(elems, count - firstCount, pred);
+        }
+
 
         static bool remove_room(INODE *node, size_t idx) {
             return --node->size == 0;
@@ -707,7 +1374,7 @@ namespace Seq
             int x = n + 1;
 
             LNODE * leaf = (LNODE *) addr;
-            cout << n << " [label=\"" << leaf->id << " (" << leaf->size << "/" << get_offset(addr, info) << ")\"]" << endl;
+            cout << n << " [label=\"" << NODE_ID(leaf, n) << " (" << leaf->size << "/" << get_offset(addr, info) << ")\"]" << endl;
 
             for (int i = 0; i < L::width; i++) {
                 auto elem = leaf->elems[i];
@@ -725,29 +1392,416 @@ namespace Seq
            }
         }
     };
-
-#ifdef ARRAY
+#else
+    // SLACK mode: every node keeps prefix counts of its children and leaves
+    // are partially filled arrays. An insert into a leaf with room is a local
+    // memmove. As in a packed memory array, an aligned run of 2^k leaves may
+    // only fill up to slack_limit. When a child is full its parent spreads the
+    // smallest aligned run of children around it that is within its limit,
+    // and a node at its own limit leaves the insert to its parent.
     TT
-        Tiered<T, Layer>::Tiered() {
-#ifdef PACK
+    struct helper {
+        typedef SlackNode<Layer::width> SNODE;
+        typedef helper<T, typename Layer::child> CHILD;
+        enum {
+            room = Layer::width * CHILD::room,
+            leaves = Layer::width * CHILD::leaves,
+            limit = room - (room - Layer::capacity) * Math<leaves>::log / Math<LeafOf<Layer>::type::leaves>::log
+        };
 
-#else
-            info.ptrs = new void*[Layer::nodes];
-            memset(info.ptrs, 0, sizeof(void*)*Layer::nodes);
-#endif
+        static void* create_node() {
+            return new SNODE(0);
+        }
 
-#ifdef PFREE
-            info.elems = new T[Layer::capacity];
-#endif
-            info.offsets = new size_t[Layer::nodes];
-            memset(info.offsets, 0, sizeof(size_t)*Layer::nodes);
+        static size_t start(SNODE * node, size_t child) {
+            return child == 0 ? 0 : node->elems[child - 1].end;
+        }
+        static size_t count(size_t addr) {
+            return ((SNODE*) addr)->count;
         }
-#else
-    TT
-        Tiered<T, Layer>::Tiered() {
+
+        // First child whose elements reach past idx, idx becomes relative to it
+        static size_t locate(SNODE * node, size_t &idx) {
+            // Children are either filled in order or spread evenly, so guess
+            // from the average size of the allocated children and walk from there
+            size_t child = node->count == 0 ? 0 : min((size_t)(Layer::width - 1), idx * node->size / node->count);
+
+            while (child > 0 && node->elems[child - 1].end > idx) child--;
+            while (child < Layer::width - 1 && node->elems[child].end <= idx) child++;
+
+            idx -= start(node, child);
+            return child;
+        }
+
+        static T& get(size_t addr, size_t idx, Info info) {
+            auto node = (SNODE*) addr;
+            size_t child = locate(node, idx);
+            return CHILD::get((size_t)node->elems[child].child, idx, info);
+        }
+
+        // Returns false without inserting if the node is at its limit, the
+        // root never is as its limit is at least the capacity
+        static bool insert(size_t addr, size_t idx, T elem, vector<T> &scratch, Info info) {
+            auto node = (SNODE*) addr;
+            if (node->count >= limit)
+                return false;
+
+            // Insert after the element preceding idx, or first in the next
+            // child if that one is full and idx is at its end
+            size_t child = 0;
+            if (idx > 0) {
+                idx--;
+                child = locate(node, idx);
+                idx++;
+
+                if (idx >= CHILD::limit && child < Layer::width - 1) {
+                    child++;
+                    idx = 0;
+                }
+            }
+
+            if (node->elems[child].child == NULL) {
+                node->elems[child].child = CHILD::create_node();
+                node->elems[child].end = start(node, child);
+                node->size++;
+            }
+
+            size_t next = child;
+            if (!CHILD::insert((size_t)node->elems[child].child, idx, elem, scratch, info)) {
+                // The whole node is within its limit, so some run is
+                for (size_t span = 2;; span *= 2) {
+                    size_t from = child & ~(span - 1);
+                    size_t to = min(from + span, (size_t)Layer::width);
+                    size_t used = start(node, min(to, (size_t)node->size)) - start(node, from);
+
+                    if (to - from == Layer::width
+                            || used < slack_limit((to - from) * CHILD::room, (to - from) * (CHILD::room - Layer::child::capacity),
+                                (to - from) * CHILD::leaves, LeafOf<Layer>::type::leaves)) {
+                        spread(node, from, to, start(node, child) + idx - start(node, from), elem, scratch);
+                        next = to;
+                        break;
+                    }
+                }
+            }
+
+            for (size_t i = next; i < node->size; i++)
+                node->elems[i].end++;
+            node->count++;
+            return true;
+        }
+
+        // Spread the elements of children from to to with elem inserted at idx
+        // evenly over them
+        static void spread(SNODE * node, size_t from, size_t to, size_t idx, T elem, vector<T> &scratch) {
+            size_t base = start(node, from);
+
+            scratch.clear();
+            for (size_t i = from; i < min(to, (size_t)node->size); i++) {
+                if (node->elems[i].end != start(node, i))
+                    CHILD::gather((size_t)node->elems[i].child, scratch);
+            }
+            scratch.insert(scratch.begin() + idx, elem);
+
+            size_t count = scratch.size();
+            size_t done = 0;
+            for (size_t i = from; i < to; i++) {
+                size_t doCount = count / (to - from) + (i - from < count % (to - from));
+                if (node->elems[i].child == NULL && doCount > 0) {
+                    node->elems[i].child = CHILD::create_node();
+                    node->size++;
+                }
+                if (node->elems[i].child != NULL)
+                    CHILD::scatter((size_t)node->elems[i].child, scratch.data() + done, doCount);
+                done += doCount;
+                node->elems[i].end = base + done;
+            }
+        }
+
+        static T remove(size_t addr, size_t idx, Info info) {
+            auto node = (SNODE*) addr;
+            size_t child = locate(node, idx);
+            for (size_t i = child; i < node->size; i++)
+                node->elems[i].end--;
+            node->count--;
+            return CHILD::remove((size_t)node->elems[child].child, idx, info);
+        }
+
+        static void gather(size_t addr, vector<T> &res) {
+            auto node = (SNODE*) addr;
+            for (size_t i = 0; i < node->size; i++) {
+                if (node->elems[i].end != start(node, i))
+                    helper<T, typename Layer::child>::gather((size_t)node->elems[i].child, res);
+            }
+        }
+
+        // Spread count elements evenly over the children
+        static void scatter(size_t addr, T* elems, size_t count) {
+            auto node = (SNODE*) addr;
+            size_t done = 0;
+
+            for (size_t i = 0; i < Layer::width; i++) {
+                size_t doCount = count / Layer::width + (i < count % Layer::width);
+                if (node->elems[i].child == NULL && doCount > 0) {
+                    node->elems[i].child = helper<T, typename Layer::child>::create_node();
+                    node->size++;
+                }
+                if (node->elems[i].child != NULL)
+                    helper<T, typename Layer::child>::scatter((size_t)node->elems[i].child, elems + done, doCount);
+                done += doCount;
+                node->elems[i].end = done;
+            }
+
+            node->count = count;
+        }
+
+        inline static T sum(size_t addr, size_t from, size_t count, Info info) {
+            T s = T();
+            auto node = (SNODE*) addr;
+            size_t child = locate(node, from);
+
+            while (count > 0) {
+                size_t doCount = min(count, node->elems[child].end - start(node, child) - from);
+                s += helper<T, typename Layer::child>::sum((size_t)node->elems[child].child, from, doCount, info);
+                count -= doCount;
+                from = 0;
+                child++;
+            }
+
+            return s;
+        }
+
+        template <class Pred>
+        static size_t find(size_t addr, size_t from, size_t count, const Pred &pred, Info info) {
+            auto node = (SNODE*) addr;
+            size_t child = locate(node, from);
+            size_t done = 0;
+
+            while (done < count) {
+                size_t doCount = min(count - done, node->elems[child].end - start(node, child) - from);
+                size_t res = helper<T, typename Layer::child>::find((size_t)node->elems[child].child, from, doCount, pred, info);
+                if (res < doCount)
+                    return done + res;
+                done += doCount;
+                from = 0;
+                child++;
+            }
+
+            return count;
+        }
+
+        template <class Pred>
+        static size_t count_if(size_t addr, size_t from, size_t count, const Pred &pred, Info info) {
+            size_t res = 0;
+            auto node = (SNODE*) addr;
+            size_t child = locate(node, from);
+
+            while (count > 0) {
+                size_t doCount = min(count, node->elems[child].end - start(node, child) - from);
+                res += helper<T, typename Layer::child>::count_if((size_t)node->elems[child].child, from, doCount, pred, info);
+                count -= doCount;
+                from = 0;
+                child++;
+            }
+
+            return res;
+        }
+
+        static int print_helper(size_t addr, int n, Info info) {
+            int x = n + 1;
+            auto node = (SNODE*) addr;
+            cout << n << " [label=\"" << NODE_ID(node, n) << " (" << node->count << ")\"]" << endl;
+
+            for (int i = 0; i < Layer::width; i++) {
+                cout << n << " -> " << x << ';' << endl;
+                if (node->elems[i].child == NULL) {
+                    cout << x << " [label=\"NULL\"]" << endl;
+                    x++;
+                } else {
+                    x = helper<T, typename Layer::child>::print_helper((size_t)node->elems[i].child, x, info);
+                }
+            }
+
+            return x;
+        }
+
+        // There are no offsets to randomize in SLACK mode
+        static void randomize(size_t addr, size_t max, Info info) {
+        }
+    };
+
+    template <class T, typename A, size_t W>
+    struct helper<T, LayerItr<A, Layer<W, LayerEnd> > > {
+        typedef LayerItr<A, Layer<W, LayerEnd> >  L;
+        enum { room = W, leaves = 1, limit = W };
+
+        static void* create_node() {
+            return new Node<T, W>(0);
+        }
+
+        static size_t count(size_t addr) {
+            return ((LNODE*) addr)->size;
+        }
+
+        static T& get(size_t addr, size_t idx, Info info) {
+            return ((LNODE*) addr)->elems[idx];
+        }
+
+        static bool insert(size_t addr, size_t idx, T elem, vector<T> &scratch, Info info) {
+            auto leaf = (LNODE*) addr;
+            if (leaf->size == W)
+                return false;
+            memmove(&leaf->elems[idx + 1], &leaf->elems[idx], (leaf->size - idx) * sizeof(T));
+            leaf->elems[idx] = elem;
+            leaf->size++;
+            return true;
+        }
+
+        static T remove(size_t addr, size_t idx, Info info) {
+            auto leaf = (LNODE*) addr;
+            T res = leaf->elems[idx];
+            leaf->size--;
+            memmove(&leaf->elems[idx], &leaf->elems[idx + 1], (leaf->size - idx) * sizeof(T));
+            return res;
+        }
+
+        static void gather(size_t addr, vector<T> &res) {
+            auto leaf = (LNODE*) addr;
+            res.insert(res.end(), leaf->elems, leaf->elems + leaf->size);
+        }
+
+        static void scatter(size_t addr, T* elems, size_t count) {
+            auto leaf = (LNODE*) addr;
+            memcpy(leaf->elems, elems, count * sizeof(T));
+            leaf->size = count;
+        }
+
+        inline static T sum(size_t addr, size_t from, size_t count, Info info) {
+            T s = T();
+            auto leaf = (LNODE*) addr;
+            for (size_t i = 0; i < count; i++)
+                s += leaf->elems[from + i];
+            return s;
+        }
+
+        template <class Pred>
+        static size_t find(size_t addr, size_t from, size_t count, const Pred &pred, Info info) {
+            return scan_find(((LNODE*) addr)->elems + from, count, pred);
+        }
+
+        template <class Pred>
+        static size_t count_if(size_t addr, size_t from, size_t count, const Pred &pred, Info info) {
+            return scan_count(((LNODE*) addr)->elems + from, count, pred);
+        }
+
+        static int print_helper(size_t addr, int n, Info info) {
+            int x = n + 1;
+
+            LNODE * leaf = (LNODE *) addr;
+            cout << n << " [label=\"" << NODE_ID(leaf, n) << " (" << leaf->size << ")\"]" << endl;
+
+            for (size_t i = 0; i < leaf->size; i++) {
+                cout << n << " -> " << x << endl;
+                cout << x << " [label=\"" << leaf->elems[i] << "\"];" << endl;
+                x++;
+            }
+
+            return x;
+        }
+
+        static void randomize(size_t addr, size_t max, Info info) {
+        }
+    };
+#endif
+
+#ifdef INDIRECT
+    // Blocks are raw memory, an element is constructed when its handle is
+    // handed out and destroyed when it is released
+    template <class T>
+        Arena<T>::~Arena() {
+            vector<bool> released(used, false);
+            for (auto handle : free)
+                released[handle] = true;
+            for (uint32_t handle = 0; handle < used; handle++)
+                if (!released[handle])
+                    (*this)[handle].~T();
+
+            for (auto block : blocks)
+                ::operator delete(block);
+        }
+
+    template <class T>
+        uint32_t Arena<T>::alloc(const T &elem) {
+            uint32_t handle;
+            if (!free.empty()) {
+                handle = free.back();
+                free.pop_back();
+            } else {
+                if ((used & ((1 << ARENA_BITS) - 1)) == 0)
+                    blocks.push_back((T*)::operator new(sizeof(T) << ARENA_BITS));
+                handle = used++;
+            }
+
+            new (&(*this)[handle]) T(elem);
+            return handle;
+        }
+
+    template <class T>
+        void Arena<T>::release(uint32_t handle) {
+            (*this)[handle].~T();
+            free.push_back(handle);
+        }
+
+    TT
+        typename Tiered<T, Layer>::Stored Tiered<T, Layer>::store(const T &elem){
+            return arena.alloc(elem);
+        }
+
+    TT
+        const T& Tiered<T, Layer>::load(const Stored &elem) const{
+            return arena[elem];
+        }
+#else
+    TT
+        typename Tiered<T, Layer>::Stored Tiered<T, Layer>::store(const T &elem){
+            return elem;
+        }
+
+    TT
+        const T& Tiered<T, Layer>::load(const Stored &elem) const{
+            return elem;
+        }
+#endif
+
+#ifdef ARRAY
+    TT
+        Tiered<T, Layer>::Tiered() {
+#ifdef PACK
+
+#else
+            info.ptrs = new void*[Layer::nodes];
+            memset(info.ptrs, 0, sizeof(void*)*Layer::nodes);
+#endif
+
+#ifdef PFREE
+            info.elems = new Stored[Layer::capacity];
+#endif
+#ifdef POOL
+            // Raw memory, a leaf's slots are constructed when it is handed out
+            // so pages of the pool are only touched once they are used
+            info.elems = ::operator new(sizeof(Stored) * (Layer::capacity + LeafOf<Layer>::type::width));
+            info.leaves = new size_t(0);
+#endif
+            info.offsets = new size_t[Layer::nodes];
+            memset(info.offsets, 0, sizeof(size_t)*Layer::nodes);
+        }
+#else
+    TT
+        Tiered<T, Layer>::Tiered() {
 
 #ifdef PPACK
             relem = {0, (size_t) new Node<Elem, Layer::width>(0)};
+#elif defined(SLACK)
+            root = (size_t) helper<Stored, Layer>::create_node();
 #else
             root = (size_t ) new Node<void*, Layer::width>(0);
 #endif
@@ -758,38 +1812,342 @@ namespace Seq
 
 
     template<class T, size_t width>
-        Node<T, width>::Node(size_t depth) : depth(depth) {
+        Node<T, width>::Node(size_t depth)
+#ifdef NODE_IDS
+            : depth(depth)
+#endif
+        {
             memset(elems, 0, sizeof(T)*width);
-            id = ID;
-            ID++;
+#ifdef NODE_IDS
+            id = ID++;
+#endif
+        }
+
+#ifdef PARALLEL
+    // Set while the thread is running tasks of a batch
+    inline bool& in_pool() {
+        static thread_local bool busy = false;
+        return busy;
+    }
+
+    inline ThreadPool::ThreadPool(size_t threads) : next(SIZE_MAX / 2), total(0), pending(0) {
+        for (size_t i = 0; i < threads; i++) {
+            workers.emplace_back([this] {
+                size_t seen = 0;
+                while (true) {
+                    unique_lock<mutex> guard(lock);
+                    start.wait(guard, [&] { return stop || generation != seen; });
+                    if (stop) return;
+                    seen = generation;
+                    active++;
+                    guard.unlock();
+                    work();
+                    guard.lock();
+                    if (--active == 0)
+                        done.notify_all();
+                }
+            });
         }
+    }
+
+    inline ThreadPool::~ThreadPool() {
+        {
+            lock_guard<mutex> guard(lock);
+            stop = true;
+        }
+        start.notify_all();
+        for (auto &worker : workers)
+            worker.join();
+    }
+
+    inline void ThreadPool::work() {
+        in_pool() = true;
+        while (true) {
+            size_t i = next.fetch_add(1);
+            if (i >= total) break;
+            (*task)(i);
+            if (pending.fetch_sub(1) == 1) {
+                lock_guard<mutex> guard(lock);
+                done.notify_all();
+            }
+        }
+        in_pool() = false;
+    }
+
+    inline void ThreadPool::run(size_t count, const function<void(size_t)> &task) {
+        if (in_pool() || workers.empty()) {
+            for (size_t i = 0; i < count; i++)
+                task(i);
+            return;
+        }
+
+        lock_guard<mutex> serial(batch);
+        {
+            lock_guard<mutex> guard(lock);
+            this->task = &task;
+            total = count;
+            pending = count;
+            next = 0;
+            generation++;
+        }
+        start.notify_all();
+
+        work();
+
+        // Wait until no worker is left inside work(), one that has claimed an
+        // index past the end must not compare it against the next batch
+        unique_lock<mutex> guard(lock);
+        done.wait(guard, [&] { return pending == 0 && active == 0; });
+        next = SIZE_MAX / 2;
+    }
+
+    inline ThreadPool& thread_pool() {
+#ifdef PARALLEL_THREADS
+        static ThreadPool pool(PARALLEL_THREADS - 1);
+#else
+        static ThreadPool pool(thread::hardware_concurrency() > 1 ? thread::hardware_concurrency() - 1 : 0);
+#endif
+        return pool;
+    }
+#endif
+
+#ifdef SLACK
+    template<size_t width>
+        SlackNode<width>::SlackNode(size_t depth)
+#ifdef NODE_IDS
+            : depth(depth)
+#endif
+        {
+            memset(elems, 0, sizeof(SlackElem)*width);
+#ifdef NODE_IDS
+            id = ID++;
+#endif
+        }
+#endif
 
     TT
         T Tiered<T, Layer>::sum(size_t from, size_t count){
-            return helper<T, Layer>::sum((size_t)root, from, count, info);
+            flush();
+#ifdef INDIRECT
+            T s = T();
+            for (size_t i = 0; i < count; i++)
+                s += (*this)[from + i];
+            return s;
+#else
+            return helper<Stored, Layer>::sum((size_t)root, from, count, info);
+#endif
+        }
+
+    TT
+        size_t Tiered<T, Layer>::find(T elem, size_t from){
+            return find_if(Equal<T>(elem), from);
+        }
+
+#ifdef PARALLEL
+    // A scan from from is split so that every task but the first starts at a
+    // top level child boundary and covers PARALLEL_CHUNK children, the first
+    // one runs up to the first such boundary
+    TT
+        size_t Tiered<T, Layer>::parallel_tasks(size_t from) const{
+            size_t block = PARALLEL_CHUNK * (Layer::capacity / Layer::width);
+            size_t first = parallel_task_start(from, 1) - from;
+            if (thread_pool().threads() == 0 || size - from <= first)
+                return 1;
+            return 1 + (size - from - first + block - 1) / block;
+        }
+
+    TT
+        size_t Tiered<T, Layer>::parallel_task_start(size_t from, size_t task) const{
+            size_t block = PARALLEL_CHUNK * (Layer::capacity / Layer::width);
+#ifdef SLACK
+            size_t at = from;
+#else
+            size_t at = (from + helper<Stored, Layer>::get_offset(root, info)) % Layer::capacity;
+#endif
+            if (task == 0)
+                return from;
+            return min(size, from + block - at % block + (task - 1) * block);
+        }
+#endif
+
+    TT
+    template <class Pred>
+        size_t Tiered<T, Layer>::find_if(Pred match, size_t from){
+            flush();
+            if (from >= size) return size;
+
+            auto pred = [&](const Stored &elem) { return match(load(elem)); };
+
+#ifdef PARALLEL
+            // Split at top level child boundaries, a task skips its part once a
+            // match before it is known
+            size_t tasks = parallel_tasks(from);
+            if (tasks > 1) {
+                atomic<size_t> best(size);
+                thread_pool().run(tasks, [&](size_t i) {
+                    size_t lo = parallel_task_start(from, i);
+                    if (lo >= best) return;
+                    size_t n = parallel_task_start(from, i + 1) - lo;
+                    size_t res = helper<Stored, Layer>::find((size_t)root, lo, n, pred, info);
+                    size_t cur = best;
+                    while (res < n && lo + res < cur && !best.compare_exchange_weak(cur, lo + res));
+                });
+                return best;
+            }
+#endif
+            return from + helper<Stored, Layer>::find((size_t)root, from, size - from, pred, info);
+        }
+
+    TT
+        bool Tiered<T, Layer>::contains(T elem){
+            return find(elem) < size;
+        }
+
+    TT
+        size_t Tiered<T, Layer>::count(T elem){
+            return count_if(Equal<T>(elem));
+        }
+
+    TT
+    template <class Pred>
+        size_t Tiered<T, Layer>::count_if(Pred match){
+            flush();
+
+            auto pred = [&](const Stored &elem) { return match(load(elem)); };
+
+#ifdef PARALLEL
+            size_t tasks = parallel_tasks(0);
+            if (tasks > 1) {
+                atomic<size_t> res(0);
+                thread_pool().run(tasks, [&](size_t i) {
+                    size_t lo = parallel_task_start(0, i);
+                    res += helper<Stored, Layer>::count_if((size_t)root, lo, parallel_task_start(0, i + 1) - lo, pred, info);
+                });
+                return res;
+            }
+#endif
+            return helper<Stored, Layer>::count_if((size_t)root, 0, size, pred, info);
         }
 
     TT
         void Tiered<T, Layer>::insert(size_t idx, T elem){
+#ifdef BUFFER
+            assert((size < Layer::capacity));
+            assert (idx <= size);
+
+            size_t k = buffer_find(idx);
+            for (size_t i = k; i < pending_ins.size(); i++)
+                pending_ins[i].first++;
+            pending_ins.insert(pending_ins.begin() + k, make_pair(idx, elem));
+            size++;
+
+            if (pending_ins.size() + pending_del.size() >= BUFFER_SIZE)
+                flush();
+#else
+            insert_direct(idx, elem);
+#endif
+        }
+
+    TT
+        void Tiered<T, Layer>::insert_direct(size_t idx, T elem){
 
             assert((size < Layer::capacity));
             assert (idx <= size);
+
+            Stored item = store(elem);
+#ifdef SLACK
+            helper<Stored, Layer>::insert(root, idx, item, scratch, info);
+#else
             if (idx >= size/2) {
-                elem = helper<T, Layer>::pop_push(elem, (size_t)root, idx, size - idx, true, info);
-                helper<T, Layer>::make_room(root, size, info);
-                helper<T, Layer>::replace(elem, (size_t)root, size, info);
+                item = helper<Stored, Layer>::pop_push(item, (size_t)root, idx, size - idx, true, info);
+                helper<Stored, Layer>::make_room(root, size, info);
+                helper<Stored, Layer>::replace(item, (size_t)root, size, info);
             } else {
-                elem = helper<T, Layer>::pop_push(elem, (size_t)root, WRAP(idx - 1, Layer::capacity), idx, false, info);
-                helper<T, Layer>::set_offset(root, WRAP((helper<T, Layer>::get_offset(root, info) - 1), Layer::capacity), info);
-                helper<T, Layer>::make_room(root, 0, info);
-                helper<T, Layer>::replace(elem, (size_t)root, 0, info);
+                item = helper<Stored, Layer>::pop_push(item, (size_t)root, WRAP(idx - 1, Layer::capacity), idx, false, info);
+                helper<Stored, Layer>::set_offset(root, WRAP((helper<Stored, Layer>::get_offset(root, info) - 1), Layer::capacity), info);
+                helper<Stored, Layer>::make_room(root, 0, info);
+                helper<Stored, Layer>::replace(item, (size_t)root, 0, info);
             }
+#endif
 
             size++;
         }
 
+    // Grow or shrink the stored sequence at the back to n elements
+    TT
+        void Tiered<T, Layer>::resize_direct(size_t n){
+            assert (n <= Layer::capacity);
+#ifdef SLACK
+            // The new slots are placeholders and the dropped ones copies the
+            // caller has moved, so no INDIRECT handles are stored or released
+            for (; size < n; size++)
+                helper<Stored, Layer>::insert(root, size, Stored(), scratch, info);
+            for (; size > n; size--)
+                helper<Stored, Layer>::remove(root, size - 1, info);
+#else
+            for (size_t i = size; i < n; i++)
+                helper<Stored, Layer>::make_room(root, i, info);
+            size = n;
+#endif
+        }
+
     TT
         void Tiered<T, Layer>::insert_sorted(T elem){
+            insert(upper_bound(elem), elem);
+        }
+
+    TT
+    template <class Itr>
+        void Tiered<T, Layer>::insert_sorted_batch(Itr first, Itr last){
+            size_t count = distance(first, last);
+            if (count == 0) return;
+
+            flush();
+
+            assert((size + count <= Layer::capacity));
+
+            vector<T> batch(first, last);
+            size_t start = upper_bound(batch[0]);
+
+            // Moving the tail one slot per inserted element is cheaper than a
+            // full cascade per element unless the tail is long and the batch short
+            if (size - start > count * Layer::width) {
+                for (size_t i = 0; i < count; i++)
+                    insert_sorted(batch[i]);
+                return;
+            }
+
+            size_t i = size, j = count, w = size + count;
+            resize_direct(size + count);
+
+            // Merge from the back so every element is moved exactly once
+            while (j > 0) {
+                if (i > start && batch[j - 1] < load(helper<Stored, Layer>::get(root, i - 1, info))) {
+                    helper<Stored, Layer>::get(root, --w, info) = helper<Stored, Layer>::get(root, --i, info);
+                } else {
+                    helper<Stored, Layer>::get(root, --w, info) = store(batch[--j]);
+                }
+            }
+        }
+
+    TT
+        size_t Tiered<T, Layer>::lower_bound(T elem) const{
+            size_t left = 0, right = size;
+
+            while (left < right) {
+                size_t mid = (left + right) / 2;
+                if ((*this)[mid] < elem) {
+                    left = mid + 1;
+                } else {
+                    right = mid;
+                }
+            }
+
+            return left;
+        }
+
+    TT
+        size_t Tiered<T, Layer>::upper_bound(T elem) const{
             size_t left = 0, right = size;
 
             while (left < right) {
@@ -801,32 +2159,225 @@ namespace Seq
                 }
             }
 
-            insert(left, elem);
+            return left;
+        }
+
+    TT
+        pair<size_t, size_t> Tiered<T, Layer>::equal_range(T elem) const{
+            return make_pair(lower_bound(elem), upper_bound(elem));
+        }
+
+    TT
+        size_t Tiered<T, Layer>::erase_value(T elem){
+            flush();
+
+            auto range = equal_range(elem);
+            size_t count = range.second - range.first;
+            if (count == 0) return 0;
+
+            if (count == 1 || size - range.second > count * Layer::width) {
+                for (size_t i = 0; i < count; i++)
+                    remove(range.first);
+                return count;
+            }
+
+#ifdef INDIRECT
+            for (size_t i = range.first; i < range.second; i++)
+                arena.release(helper<Stored, Layer>::get(root, i, info));
+#endif
+
+            // Close the gap by moving the tail down in a single sweep
+            for (size_t i = range.second; i < size; i++) {
+                helper<Stored, Layer>::get(root, i - count, info) = helper<Stored, Layer>::get(root, i, info);
+            }
+
+            resize_direct(size - count);
+            return count;
+        }
+
+    TT
+        size_t Tiered<T, Layer>::count_range(T lo, T hi) const{
+            if (!(lo < hi)) return 0;
+            return lower_bound(hi) - lower_bound(lo);
+        }
+
+    TT
+        bool Tiered<T, Layer>::contains_sorted(T elem) const{
+            size_t idx = lower_bound(elem);
+            return idx < size && !(elem < (*this)[idx]);
+        }
+
+    TT
+        size_t Tiered<T, Layer>::rank(T elem) const{
+            return lower_bound(elem);
+        }
+
+    TT
+        const T& Tiered<T, Layer>::nth(size_t idx) const{
+            return (*this)[idx];
         }
 
     TT
         const T& Tiered<T, Layer>::operator[](size_t idx) const{
             assert (idx < size);
 
-            return helper<T, Layer>::get((size_t)root, idx, info);
+#ifdef BUFFER
+            size_t k = buffer_find(idx);
+            if (k < pending_ins.size() && pending_ins[k].first == idx)
+                return pending_ins[k].second;
+            idx = buffer_translate(idx - k);
+#endif
+            return load(helper<Stored, Layer>::get((size_t)root, idx, info));
         }
 
+#ifdef BUFFER
+    // Number of pending inserts at logical positions before idx
     TT
-        size_t Tiered<T, Layer>::successor(T elem){
-            size_t left = 0, right = size;
+        size_t Tiered<T, Layer>::buffer_find(size_t idx) const{
+            size_t left = 0, right = pending_ins.size();
 
             while (left < right) {
                 size_t mid = (left + right) / 2;
-                if (elem < (*this)[mid]) {
-                    right = mid;
-                } else {
+                if (pending_ins[mid].first < idx) {
                     left = mid + 1;
+                } else {
+                    right = mid;
                 }
             }
 
             return left;
         }
 
+    // Map the idx'th surviving tree element to its position in the tree
+    TT
+        size_t Tiered<T, Layer>::buffer_translate(size_t idx) const{
+            for (size_t i = 0; i < pending_del.size() && pending_del[i] <= idx; i++)
+                idx++;
+            return idx;
+        }
+
+#ifndef SLACK
+    // Cascade count positions from position from, carrying carried garbage
+    // elements in and applying the edits on the way
+    TT
+        void Tiered<T, Layer>::buffer_cascade(size_t carried, size_t from, size_t count, bool goRight){
+            carry.resize(carried + edits.size());
+            helper<Stored, Layer>::pop_push_edits(carry.data(), carried, root, from, count, goRight, edits.data(), edits.size(), 0, scratch, info);
+        }
+
+    // Whether the pending edits share top-level children, on average
+    // BUFFER_MERGE of them per child their tree positions span
+    TT
+        bool Tiered<T, Layer>::buffer_clustered() const{
+            size_t n = pending_ins.size(), lo = size, hi = 0;
+
+            if (!pending_del.empty()) {
+                lo = pending_del.front();
+                hi = pending_del.back();
+            }
+            if (n > 0) {
+                lo = min(lo, pending_ins.front().first);
+                hi = max(hi, pending_ins.back().first - (n - 1));
+            }
+
+            return n + pending_del.size() >= BUFFER_MERGE * ((hi - lo) / (Layer::capacity / Layer::width) + 1);
+        }
+
+    // Apply the pending edits with one cascade from each end of the tree for
+    // the removes and then for the inserts, a cascade applies every edit it
+    // passes. A child is rotated once by the number of elements crossing it,
+    // where one cascade per edit would rotate it once per edit
+    TT
+        void Tiered<T, Layer>::buffer_merge(){
+            edits.clear();
+            size_t m = pending_del.size();
+            size_t s = std::lower_bound(pending_del.begin(), pending_del.end(), size / 2) - pending_del.begin();
+
+            // Elements before a remove in the front half move right, garbage
+            // enters at the front
+            for (size_t i = 0; i < s; i++)
+                edits.push_back({pending_del[i], NULL});
+            if (s > 0)
+                buffer_cascade(s, 0, pending_del[s - 1] + 1, true);
+
+            // Elements after a remove in the back half move left, garbage
+            // enters at the back
+            edits.clear();
+            for (size_t i = m; i > s; i--)
+                edits.push_back({size - 1 - pending_del[i - 1], NULL});
+            if (s < m)
+                buffer_cascade(m - s, size - 1, size - pending_del[s], false);
+
+            helper<Stored, Layer>::set_offset(root, (helper<Stored, Layer>::get_offset(root, info) + s) % Layer::capacity, info);
+            size -= m;
+
+            // Insert i has pending_ins[i].first - i tree elements before it
+            size_t n = pending_ins.size();
+            s = 0;
+            while (s < n && pending_ins[s].first - s < size / 2)
+                s++;
+
+            for (size_t i = 1; i <= s; i++)
+                helper<Stored, Layer>::make_room(root, Layer::capacity - i, info);
+            for (size_t i = size; i < size + n - s; i++)
+                helper<Stored, Layer>::make_room(root, i, info);
+
+            // Elements before an insert in the front half move left, past the
+            // front of the tree
+            edits.clear();
+            for (size_t i = s; i > 0; i--)
+                edits.push_back({pending_ins[s - 1].first - (s - 1) - (pending_ins[i - 1].first - (i - 1)), &pending_ins[i - 1].second});
+            if (s > 0) {
+                size_t first = pending_ins[s - 1].first - (s - 1);
+                buffer_cascade(0, (first + Layer::capacity - 1) % Layer::capacity, first + s, false);
+            }
+
+            // Elements after an insert in the back half move right
+            edits.clear();
+            for (size_t i = s; i < n; i++)
+                edits.push_back({pending_ins[i].first - i - (pending_ins[s].first - s), &pending_ins[i].second});
+            if (s < n)
+                buffer_cascade(0, pending_ins[s].first - s, size - (pending_ins[s].first - s) + n - s, true);
+
+            helper<Stored, Layer>::set_offset(root, (helper<Stored, Layer>::get_offset(root, info) + Layer::capacity - s) % Layer::capacity, info);
+            size += n;
+        }
+#endif
+#endif
+
+    TT
+        void Tiered<T, Layer>::flush(){
+#ifdef BUFFER
+            if (pending_ins.empty() && pending_del.empty()) return;
+
+            size_t logical = size;
+            size = size - pending_ins.size() + pending_del.size();
+
+#ifndef SLACK
+            if (buffer_clustered()) {
+                buffer_merge();
+            } else
+#endif
+            {
+                // Removes from the back keep the remaining tree positions valid,
+                // inserts in ascending order land at their final positions
+                for (size_t i = pending_del.size(); i > 0; i--)
+                    remove_direct(pending_del[i - 1]);
+                for (size_t i = 0; i < pending_ins.size(); i++)
+                    insert_direct(pending_ins[i].first, pending_ins[i].second);
+            }
+            assert(size == logical);
+
+            pending_ins.clear();
+            pending_del.clear();
+#endif
+        }
+
+    TT
+        size_t Tiered<T, Layer>::successor(T elem){
+            return upper_bound(elem);
+        }
+
     TT
         void Tiered<T, Layer>::fill(T *res){
             fill(res, root, 0, size);
@@ -835,30 +2386,63 @@ namespace Seq
 
     TT
         void Tiered<T, Layer>::remove(size_t idx) {
+#ifdef BUFFER
+            assert (idx < size);
+
+            size_t k = buffer_find(idx);
+            if (k < pending_ins.size() && pending_ins[k].first == idx) {
+                pending_ins.erase(pending_ins.begin() + k);
+            } else {
+                size_t pos = buffer_translate(idx - k);
+                pending_del.insert(std::lower_bound(pending_del.begin(), pending_del.end(), pos), pos);
+            }
+            for (size_t i = k; i < pending_ins.size(); i++)
+                pending_ins[i].first--;
+            size--;
+
+            if (pending_ins.size() + pending_del.size() >= BUFFER_SIZE)
+                flush();
+#else
+            remove_direct(idx);
+#endif
+        }
+
+    TT
+        void Tiered<T, Layer>::remove_direct(size_t idx) {
+#ifdef INDIRECT
+            arena.release(helper<Stored, Layer>::get(root, idx, info));
+#endif
+#ifdef SLACK
+            helper<Stored, Layer>::remove(root, idx, info);
+            size--;
+#else
             if (idx >= size/2) {
                 size--;
-                T garbage = {};
-                helper<T, Layer>::pop_push(garbage, root, size, size - idx, false, info);
+                Stored garbage = {};
+                helper<Stored, Layer>::pop_push(garbage, root, size, size - idx + 1, false, info);
             } else {
-                T garbage = {};
-                helper<T, Layer>::pop_push(garbage, root, 0, idx + 1, true, info);
+                Stored garbage = {};
+                helper<Stored, Layer>::pop_push(garbage, root, 0, idx + 1, true, info);
                 size--;
 
-                helper<T, Layer>::set_offset(root, WRAP((helper<T, Layer>::get_offset(root, info)) + 1, Layer::capacity), info);
+                helper<Stored, Layer>::set_offset(root, WRAP((helper<Stored, Layer>::get_offset(root, info)) + 1, Layer::capacity), info);
             }
+#endif
         }
 
     TT
         void Tiered<T, Layer>::print(){
             cout << "digraph G {" << endl;
-            helper<T, Layer>::print_helper(root, 0);
+            helper<Stored, Layer>::print_helper(root, 0);
             cout << "}" << endl;
         }
 
     TT
         void Tiered<T, Layer>::randomize() {
-            helper<T, Layer>::randomize(root, size, info);
+            flush();
+            helper<Stored, Layer>::randomize(root, size, info);
         }
 
 
 }
+#endif
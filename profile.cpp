@@ -0,0 +1,195 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "templated_tiered.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <chrono>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#ifndef MAX
+#define MAX (1000000)
+#endif
+
+#ifndef LAYOUT
+#define LAYOUT "default"
+#endif
+
+using namespace std;
+using namespace Seq;
+
+// Hardware counters read around each workload through perf_event_open.
+// Every counter is opened on its own so one the machine lacks only blanks
+// its column, and values are scaled when the kernel had to multiplex them.
+// Without any counters (not Linux, a container or perf_event_paranoid) only
+// the time per operation is reported.
+struct Counter {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+    int fd;
+};
+
+#ifdef __linux__
+#define CACHE_MISS(cache) (PERF_COUNT_HW_CACHE_##cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) \
+        | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+Counter counters[] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1},
+    {"instr", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, -1},
+    {"L1d-miss", PERF_TYPE_HW_CACHE, CACHE_MISS(L1D), -1},
+    {"LLC-miss", PERF_TYPE_HW_CACHE, CACHE_MISS(LL), -1},
+    {"dTLB-miss", PERF_TYPE_HW_CACHE, CACHE_MISS(DTLB), -1},
+    {"br-miss", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, -1},
+};
+
+bool open_counter(Counter &c){
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = c.type;
+    attr.config = c.config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // Count threads created after this too, the PARALLEL workers start on
+    // first use of the pool so their work is included
+    attr.inherit = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    c.fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    return c.fd >= 0;
+}
+
+void start(Counter &c){
+    ioctl(c.fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(c.fd, PERF_EVENT_IOC_ENABLE, 0);
+}
+
+// Counter value since start, or -1 if it could not be read or never ran
+double stop(Counter &c){
+    uint64_t v[3];
+    ioctl(c.fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(c.fd, v, sizeof(v)) != sizeof(v) || v[2] == 0)
+        return -1;
+    return double(v[0]) * v[1] / v[2];
+}
+#else
+Counter counters[] = {{"", 0, 0, -1}};
+
+bool open_counter(Counter &c){ return false; }
+void start(Counter &c){}
+double stop(Counter &c){ return -1; }
+#endif
+
+const size_t COUNTERS = sizeof(counters) / sizeof(counters[0]);
+bool available = false;
+
+typedef LayerItr<LayerEnd, Layer<128, Layer<128, Layer<128>>>> Layers;
+
+void header(){
+    printf("%-24s %-10s %10s", "layout", "workload", "ns/op");
+    if (available)
+        for (size_t i = 0; i < COUNTERS; i++)
+            printf(" %10s", counters[i].name);
+    printf("\n");
+}
+
+// Runs work(), which does ops operations, and prints the cost per operation
+template <class Work>
+void measure(const char *workload, size_t ops, Work work){
+    double values[COUNTERS];
+
+    for (size_t i = 0; i < COUNTERS; i++)
+        if (counters[i].fd >= 0)
+            start(counters[i]);
+
+    auto begin = chrono::steady_clock::now();
+    work();
+    auto end = chrono::steady_clock::now();
+
+    // Stop in reverse so the first counters see least of the others
+    for (size_t i = COUNTERS; i-- > 0;)
+        values[i] = counters[i].fd >= 0 ? stop(counters[i]) : -1;
+
+    printf("%-24s %-10s %10.1f", LAYOUT, workload,
+            chrono::duration<double, nano>(end - begin).count() / ops);
+    if (available) {
+        for (size_t i = 0; i < COUNTERS; i++) {
+            if (values[i] < 0)
+                printf(" %10s", "n/a");
+            else
+                printf(" %10.2f", values[i] / ops);
+        }
+    }
+    printf("\n");
+}
+
+int main(int argc, char * argv[])
+{
+    size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : MAX;
+    n = min(n, (size_t)Layers::capacity - 1);
+
+    for (size_t i = 0; i < COUNTERS; i++)
+        available |= open_counter(counters[i]);
+    if (!available)
+        fprintf(stderr, "hardware counters unavailable, reporting time only\n");
+
+    header();
+
+    auto *tiered = new Tiered<int, Layers>();
+    vector<size_t> idx(n);
+    volatile int sink = 0;
+
+    srand(0);
+    for (size_t i = 0; i < n; i++)
+        idx[i] = rand() % (i + 1);
+
+    measure("insert", n, [&]{
+        for (size_t i = 0; i < n; i++)
+            tiered->insert(idx[i], i);
+    });
+
+    for (size_t i = 0; i < n; i++)
+        idx[i] = rand() % n;
+
+    measure("access", n, [&]{
+        int s = 0;
+        for (size_t i = 0; i < n; i++)
+            s += (*tiered)[idx[i]];
+        sink = s;
+    });
+
+    measure("scan", n, [&]{
+        int s = 0;
+        for (size_t i = 0; i < n; i++)
+            s += (*tiered)[i];
+        sink = s;
+    });
+
+    for (size_t i = 0; i < n; i++)
+        idx[i] = rand() % (n - i);
+
+    measure("remove", n, [&]{
+        for (size_t i = 0; i < n; i++)
+            tiered->remove(idx[i]);
+    });
+
+    (void)sink;
+    delete tiered;
+
+    for (size_t i = 0; i < COUNTERS; i++)
+        if (counters[i].fd >= 0)
+            close(counters[i].fd);
+
+    return 0;
+}
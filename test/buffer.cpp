@@ -0,0 +1,74 @@
+#include "templated_tiered.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace std;
+using namespace Seq;
+
+// Inserts and removes through the BUFFER edit buffer checked against a
+// std::vector. Phases alternate between bursts of edits around one spot,
+// which flush by merging them into one cascade per end, and edits scattered
+// over the whole sequence, which flush by replaying them one by one. Built by
+// make check for every layout with a small BUFFER_SIZE, once with the default
+// BUFFER_MERGE and once with BUFFER_MERGE=1 so nearly every flush merges.
+
+#ifndef OPS
+#define OPS 40000
+#endif
+
+typedef LayerItr<LayerEnd, Layer<8, Layer<8, Layer<16>>>> Layers;
+
+int main()
+{
+    Tiered<int, Layers> seq;
+    vector<int> model;
+    size_t capacity = Layers::capacity;
+
+    srand(1);
+    for (int i = 0; i < OPS; i++) {
+        bool burst = (i / 500) % 2;
+        // Bursts move around so they hit both ends and wrapped offsets
+        size_t spot = (i / 1000) * 131 % (model.size() + 1);
+
+        if (model.empty() || (rand() % 2 == 0 && model.size() < capacity)) {
+            size_t idx = burst ? min(model.size(), spot + rand() % 8) : rand() % (model.size() + 1);
+            int elem = rand();
+            seq.insert(idx, elem);
+            model.insert(model.begin() + idx, elem);
+        } else {
+            size_t idx = burst ? min(model.size() - 1, spot + rand() % 8) : rand() % model.size();
+            seq.remove(idx);
+            model.erase(model.begin() + idx);
+        }
+
+        if (rand() % 50 == 0)
+            seq.flush();
+
+        if (seq.size != model.size()) {
+            printf("size %zu instead of %zu after %d operations\n", seq.size, model.size(), i + 1);
+            return 1;
+        }
+
+        // Reads see pending edits before they are flushed
+        if (i % 16 == 0) {
+            for (size_t j = 0; j < model.size(); j++) {
+                if (seq[j] != model[j]) {
+                    printf("element %zu differs after %d operations\n", j, i + 1);
+                    return 1;
+                }
+            }
+        }
+    }
+
+    seq.flush();
+    for (size_t j = 0; j < model.size(); j++) {
+        if (seq[j] != model[j]) {
+            printf("element %zu differs after the final flush\n", j);
+            return 1;
+        }
+    }
+
+    printf("ok\n");
+    return 0;
+}
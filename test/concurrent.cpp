@@ -0,0 +1,128 @@
+#include "concurrent_tiered.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <thread>
+
+using namespace std;
+using namespace Seq;
+
+// Several writers insert, read and remove at random positions of one
+// ConcurrentTiered while shards fill up and exchange blocks. Run it under
+// ThreadSanitizer (make tsan) to check the locking, the element counts and
+// values are checked afterwards.
+
+#ifndef THREADS
+#define THREADS 4
+#endif
+
+#ifndef OPS
+#define OPS 1000
+#endif
+
+#ifndef MIXED
+#define MIXED 50000
+#endif
+
+typedef ConcurrentTiered<int, LayerItr<LayerEnd, Layer<8, Layer<8, Layer<16>>>>, 6> Sequence;
+
+enum Where { FRONT, MIDDLE, BACK, RANDOM };
+
+// Fill a sequence to its capacity from one thread, checked against a
+// std::vector, so shards have to pass blocks on until all of them are full
+template <class Filled>
+bool fill(Where where){
+    Filled seq;
+    vector<int> model;
+
+    for (int i = 0; i < Filled::capacity; i++) {
+        size_t idx = where == FRONT ? 0 : where == MIDDLE ? i / 2 : where == BACK ? i : rand() % (i + 1);
+        seq.insert(idx, i);
+        model.insert(model.begin() + idx, i);
+    }
+
+    if (seq.size() != model.size()) {
+        printf("size %zu when filled, expected %zu\n", seq.size(), model.size());
+        return false;
+    }
+    for (size_t i = 0; i < model.size(); i++) {
+        if (seq[i] != model[i]) {
+            printf("element %zu differs when filled\n", i);
+            return false;
+        }
+    }
+    return true;
+}
+
+template <class Filled>
+bool fill_all(){
+    return fill<Filled>(FRONT) && fill<Filled>(MIDDLE) && fill<Filled>(BACK) && fill<Filled>(RANDOM);
+}
+
+int main()
+{
+    if (!fill_all<ConcurrentTiered<int, LayerItr<LayerEnd, Layer<4, Layer<8>>>, 5> >()
+            || !fill_all<ConcurrentTiered<int, LayerItr<LayerEnd, Layer<16, Layer<16>>>, 4> >()
+            || !fill_all<Sequence>())
+        return 1;
+
+    Sequence seq;
+    vector<thread> writers;
+
+    // Only inserts, so the size seen before an insert is a valid position
+    for (int t = 0; t < THREADS; t++) {
+        writers.emplace_back([&seq, t]{
+            unsigned seed = t;
+            for (int i = 0; i < OPS; i++) {
+                seq.insert(rand_r(&seed) % (seq.size() + 1), t * OPS + i);
+                if (i % 8 == 0)
+                    (void)seq[rand_r(&seed) % seq.size()];
+                // Interleave the writers even on a single core
+                if (i % 16 == 0)
+                    this_thread::yield();
+            }
+        });
+    }
+    for (auto &w : writers)
+        w.join();
+    writers.clear();
+
+    size_t size = seq.size();
+    vector<int> elems;
+    for (size_t i = 0; i < size; i++)
+        elems.push_back(seq[i]);
+    sort(elems.begin(), elems.end());
+    for (int i = 0; i < THREADS * OPS; i++) {
+        if (elems[i] != i) {
+            printf("element %d lost after inserts\n", i);
+            return 1;
+        }
+    }
+
+    // Every writer alternates an insert and a remove, so at most one element
+    // per writer is missing and positions below size - THREADS stay valid
+    for (int t = 0; t < THREADS; t++) {
+        writers.emplace_back([&seq, t, size]{
+            unsigned seed = t + THREADS;
+            for (int i = 0; i < MIXED; i++) {
+                seq.insert(rand_r(&seed) % (size - THREADS), -1);
+                seq.remove(rand_r(&seed) % (size - THREADS));
+                (void)seq[rand_r(&seed) % (size - THREADS)];
+                if (i % 16 == 0)
+                    this_thread::yield();
+            }
+        });
+    }
+    for (auto &w : writers)
+        w.join();
+
+    if (seq.size() != size) {
+        printf("size %zu after mixed updates, expected %zu\n", seq.size(), size);
+        return 1;
+    }
+
+    printf("ok\n");
+    return 0;
+}
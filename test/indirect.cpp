@@ -0,0 +1,124 @@
+#include "templated_tiered.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+
+using namespace std;
+using namespace Seq;
+
+// INDIRECT checked against a std::vector with an element type that counts
+// its live objects. The arena must construct an element when it is inserted
+// and destroy it when it is removed, so after every step exactly one object
+// per stored element is alive, and none once the tree is gone. Random
+// inserts and removes are followed by a sorted phase with insert_sorted_batch
+// and erase_value, which grow and shrink the tree while moving handles.
+// Built by make check with INDIRECT, alone and together with SLACK and POOL.
+
+#ifndef OPS
+#define OPS 20000
+#endif
+
+struct Tracked {
+    static long live;
+    int value;
+
+    Tracked(int value = 0) : value(value) { live++; }
+    Tracked(const Tracked &other) : value(other.value) { live++; }
+    Tracked& operator=(const Tracked &other) { value = other.value; return *this; }
+    ~Tracked() { live--; }
+
+    bool operator<(const Tracked &other) const { return value < other.value; }
+    bool operator==(const Tracked &other) const { return value == other.value; }
+};
+
+long Tracked::live = 0;
+
+typedef LayerItr<LayerEnd, Layer<8, Layer<8, Layer<16>>>> Layers;
+
+bool same(const Tiered<Tracked, Layers> &seq, const vector<int> &model, const char *what, int op){
+    if (seq.size != model.size()) {
+        printf("%s: size %zu instead of %zu after %d operations\n", what, seq.size, model.size(), op);
+        return false;
+    }
+    for (size_t j = 0; j < model.size(); j++) {
+        if (seq[j].value != model[j]) {
+            printf("%s: element %zu differs after %d operations\n", what, j, op);
+            return false;
+        }
+    }
+    if (Tracked::live != (long)model.size()) {
+        printf("%s: %ld live elements for %zu after %d operations\n", what, Tracked::live, model.size(), op);
+        return false;
+    }
+    return true;
+}
+
+int main()
+{
+    {
+        Tiered<Tracked, Layers> seq;
+        vector<int> model;
+
+        srand(1);
+        for (int i = 0; i < OPS; i++) {
+            if (model.empty() || (rand() % 3 != 0 && model.size() < Layers::capacity)) {
+                size_t idx = rand() % (model.size() + 1);
+                int elem = rand() % 1000;
+                seq.insert(idx, elem);
+                model.insert(model.begin() + idx, elem);
+            } else {
+                size_t idx = rand() % model.size();
+                seq.remove(idx);
+                model.erase(model.begin() + idx);
+            }
+
+            if (i % 64 == 0 && !same(seq, model, "random", i + 1))
+                return 1;
+        }
+
+        while (!model.empty()) {
+            seq.remove(model.size() - 1);
+            model.pop_back();
+        }
+
+        for (int i = 0; i < OPS / 10; i++) {
+            int op = rand() % 3;
+
+            if (op == 0 && model.size() + 8 <= Layers::capacity) {
+                vector<Tracked> batch(1 + rand() % 8);
+                for (auto &elem : batch)
+                    elem.value = rand() % 20;
+                sort(batch.begin(), batch.end());
+                seq.insert_sorted_batch(batch.begin(), batch.end());
+                for (auto &elem : batch)
+                    model.insert(upper_bound(model.begin(), model.end(), elem.value), elem.value);
+            } else if (op == 1 && model.size() < Layers::capacity) {
+                int elem = rand() % 20;
+                seq.insert_sorted(elem);
+                model.insert(upper_bound(model.begin(), model.end(), elem), elem);
+            } else {
+                int elem = rand() % 20;
+                size_t erased = seq.erase_value(elem);
+                auto range = equal_range(model.begin(), model.end(), elem);
+                if (erased != (size_t)(range.second - range.first)) {
+                    printf("sorted: erase_value(%d) erased %zu instead of %zu\n", elem, erased, (size_t)(range.second - range.first));
+                    return 1;
+                }
+                model.erase(range.first, range.second);
+            }
+
+            if (!same(seq, model, "sorted", i + 1))
+                return 1;
+        }
+    }
+
+    if (Tracked::live != 0) {
+        printf("%ld elements left alive by the destroyed tree\n", Tracked::live);
+        return 1;
+    }
+
+    printf("ok\n");
+    return 0;
+}
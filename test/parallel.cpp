@@ -0,0 +1,60 @@
+#include "templated_tiered.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace std;
+using namespace Seq;
+
+// Random inserts, removes and searches checked against a std::vector. Built
+// by make tsan with PARALLEL_MIN and PARALLEL_CHUNK at 1, so every shift that
+// crosses a whole child and every search runs on the thread pool, one child
+// per task, under ThreadSanitizer.
+
+#ifndef OPS
+#define OPS 20000
+#endif
+
+typedef Tiered<int, LayerItr<LayerEnd, Layer<8, Layer<8, Layer<16>>>>> Sequence;
+
+int main()
+{
+    Sequence seq;
+    vector<int> model;
+    size_t capacity = LayerItr<LayerEnd, Layer<8, Layer<8, Layer<16>>>>::capacity;
+
+    srand(1);
+    for (int i = 0; i < OPS; i++) {
+        if (model.empty() || (rand() % 3 != 0 && model.size() < capacity)) {
+            size_t idx = rand() % (model.size() + 1);
+            int elem = rand() % 1000;
+            seq.insert(idx, elem);
+            model.insert(model.begin() + idx, elem);
+        } else {
+            size_t idx = rand() % model.size();
+            seq.remove(idx);
+            model.erase(model.begin() + idx);
+        }
+
+        if (i % 64 == 0) {
+            for (size_t j = 0; j < model.size(); j++) {
+                if (seq[j] != model[j]) {
+                    printf("element %zu differs after %d operations\n", j, i + 1);
+                    return 1;
+                }
+            }
+
+            int elem = rand() % 1000;
+            size_t from = rand() % (model.size() + 1);
+            size_t expect = find(model.begin() + from, model.end(), elem) - model.begin();
+            if (seq.find(elem, from) != expect || seq.count(elem) != (size_t)std::count(model.begin(), model.end(), elem)
+                    || seq.contains(elem) != (std::find(model.begin(), model.end(), elem) != model.end())) {
+                printf("search for %d differs after %d operations\n", elem, i + 1);
+                return 1;
+            }
+        }
+    }
+
+    printf("ok\n");
+    return 0;
+}
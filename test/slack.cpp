@@ -0,0 +1,144 @@
+#include "templated_tiered.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+
+using namespace std;
+using namespace Seq;
+
+// SLACK checked against a std::vector. Every tree is filled to its reduced
+// capacity by inserts at the front, in the middle and at random positions,
+// so the density limits of every run of leaves are reached and spreads of
+// every size happen, and then drained again. A sorted phase covers
+// erase_value and insert_sorted_batch, which grow and shrink the tree at
+// the back. Built by make check with SLACK.
+
+#ifndef OPS
+#define OPS 20000
+#endif
+
+enum Where { FRONT, MIDDLE, RANDOM };
+
+const char *names[] = {"front", "middle", "random"};
+
+template <class Sequence>
+bool same(const Sequence &seq, const vector<int> &model, const char *what){
+    if (seq.size != model.size()) {
+        printf("%s: size %zu instead of %zu\n", what, seq.size, model.size());
+        return false;
+    }
+    for (size_t j = 0; j < model.size(); j++) {
+        if (seq[j] != model[j]) {
+            printf("%s: element %zu differs\n", what, j);
+            return false;
+        }
+    }
+    return true;
+}
+
+template <class Layers>
+bool fill(Where where){
+    Tiered<int, Layers> seq;
+    vector<int> model;
+
+    for (size_t i = 0; i < Layers::capacity; i++) {
+        size_t idx = where == FRONT ? 0 : where == MIDDLE ? model.size() / 2 : rand() % (model.size() + 1);
+        int elem = rand();
+        seq.insert(idx, elem);
+        model.insert(model.begin() + idx, elem);
+
+        if (i % 16 == 0 && !same(seq, model, names[where]))
+            return false;
+    }
+    if (!same(seq, model, names[where]))
+        return false;
+
+    while (!model.empty()) {
+        size_t idx = where == FRONT ? 0 : where == MIDDLE ? model.size() / 2 : rand() % model.size();
+        seq.remove(idx);
+        model.erase(model.begin() + idx);
+
+        if (model.size() % 16 == 0 && !same(seq, model, names[where]))
+            return false;
+    }
+    return true;
+}
+
+// Random inserts and removes around half full, so leaves fill and empty
+// again, followed by sorted inserts and erases
+template <class Layers>
+bool mixed(){
+    Tiered<int, Layers> seq;
+    vector<int> model;
+
+    for (int i = 0; i < OPS; i++) {
+        if (model.empty() || (rand() % 3 != 0 && model.size() < Layers::capacity)) {
+            size_t idx = rand() % (model.size() + 1);
+            int elem = rand() % 1000;
+            seq.insert(idx, elem);
+            model.insert(model.begin() + idx, elem);
+        } else {
+            size_t idx = rand() % model.size();
+            seq.remove(idx);
+            model.erase(model.begin() + idx);
+        }
+
+        if (i % 64 == 0 && !same(seq, model, "mixed"))
+            return false;
+    }
+
+    while (!model.empty()) {
+        seq.remove(model.size() - 1);
+        model.pop_back();
+    }
+
+    for (int i = 0; i < OPS / 10; i++) {
+        int op = rand() % 3;
+
+        if (op == 0 && model.size() + 8 <= Layers::capacity) {
+            vector<int> batch(1 + rand() % 8);
+            for (auto &elem : batch)
+                elem = rand() % 20;
+            sort(batch.begin(), batch.end());
+            seq.insert_sorted_batch(batch.begin(), batch.end());
+            for (auto elem : batch)
+                model.insert(upper_bound(model.begin(), model.end(), elem), elem);
+        } else if (op == 1 && model.size() < Layers::capacity) {
+            int elem = rand() % 20;
+            seq.insert_sorted(elem);
+            model.insert(upper_bound(model.begin(), model.end(), elem), elem);
+        } else {
+            int elem = rand() % 20;
+            size_t erased = seq.erase_value(elem);
+            auto range = equal_range(model.begin(), model.end(), elem);
+            if (erased != (size_t)(range.second - range.first)) {
+                printf("sorted: erase_value(%d) erased %zu instead of %zu\n", elem, erased, (size_t)(range.second - range.first));
+                return false;
+            }
+            model.erase(range.first, range.second);
+        }
+
+        if (!same(seq, model, "sorted"))
+            return false;
+    }
+    return true;
+}
+
+template <class Layers>
+bool run(){
+    return fill<Layers>(FRONT) && fill<Layers>(MIDDLE) && fill<Layers>(RANDOM) && mixed<Layers>();
+}
+
+int main()
+{
+    srand(1);
+    if (!run<LayerItr<LayerEnd, Layer<8, Layer<8, Layer<16>>>>>()
+            || !run<LayerItr<LayerEnd, Layer<8, Layer<16>>>>()
+            || !run<LayerItr<LayerEnd, Layer<4, Layer<4, Layer<4, Layer<8>>>>>>())
+        return 1;
+
+    printf("ok\n");
+    return 0;
+}